@@ -0,0 +1,80 @@
+#pragma once
+
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+
+// Subtree aggregates for BinaryTree. An augment is a monoid over the values:
+//
+//   using Value = ...;                                  - what every node caches for its subtree
+//   static Value identity();                            - aggregate of an empty range
+//   static Value lift(const T& value);                  - aggregate of a single node
+//   static Value combine(const Value& a, const Value& b); - associative; a holds the smaller keys
+//
+// combine() need not be commutative: aggregates are always combined in key order. Pass the
+// augment as the fourth template argument of BinaryTree (AugmentedTree<T, A> for int keys);
+// aggregate(lo, hi) then answers in O(height) instead of visiting the range.
+struct NoAugment {
+    using Value = void;
+};
+
+// The aggregate field of a node. Nodes derive from it, so without an augment it takes no space.
+template<typename Augment>
+struct AugmentSlot {
+    typename Augment::Value aggregate{};
+};
+
+template<>
+struct AugmentSlot<NoAugment> {};
+
+template<typename T>
+struct RangeSum {
+    using Value = T;
+    static Value identity() { return T{}; }
+    static Value lift(const T& value) { return value; }
+    static Value combine(const Value& a, const Value& b) { return a + b; }
+};
+
+template<typename T>
+struct RangeCount {
+    using Value = int64_t;
+    static Value identity() { return 0; }
+    static Value lift(const T&) { return 1; }
+    static Value combine(const Value& a, const Value& b) { return a + b; }
+};
+
+template<typename T>
+struct RangeMin {
+    using Value = T;
+    static Value identity() {
+        return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max();
+    }
+    static Value lift(const T& value) { return value; }
+    static Value combine(const Value& a, const Value& b) { return std::min(a, b); }
+};
+
+template<typename T>
+struct RangeMax {
+    using Value = T;
+    static Value identity() {
+        return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest();
+    }
+    static Value lift(const T& value) { return value; }
+    static Value combine(const Value& a, const Value& b) { return std::max(a, b); }
+};
+
+// Count, sum, min and max at once; min and max are meaningless when count == 0.
+template<typename T>
+struct RangeStats {
+    struct Value {
+        int64_t count = 0;
+        T sum{};
+        T min = RangeMin<T>::identity();
+        T max = RangeMax<T>::identity();
+    };
+    static Value identity() { return Value(); }
+    static Value lift(const T& value) { return Value{ 1, value, value, value }; }
+    static Value combine(const Value& a, const Value& b) {
+        return Value{ a.count + b.count, a.sum + b.sum, std::min(a.min, b.min), std::max(a.max, b.max) };
+    }
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include "error.hpp"
+
+struct BenchResult {
+    std::string name;
+    std::string engine;
+    std::string distribution;
+    size_t n;
+    size_t samples;
+    double p50Ns;
+    double p99Ns;
+    double meanNs;
+    double opsPerSec;
+    double bytesPerElement;
+};
+
+// Runs every benchmark `warmups` times untimed and `repetitions` times timed. Point benchmarks
+// time each operation separately, bulk benchmarks time one whole run; p50/p99 are taken over
+// those samples. Results are tagged with the current engine, so the same workload can be run
+// against BinaryTree and the baseline containers and compared row by row.
+class BenchSuite {
+private:
+    int warmups;
+    int repetitions;
+    std::string engine;
+    std::vector<BenchResult> results;
+
+    static double Nanos(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+        return std::chrono::duration<double, std::nano>(b - a).count();
+    }
+
+    static double Percentile(std::vector<double>& samples, double p) {
+        if (samples.empty()) return 0;
+        size_t idx = static_cast<size_t>(p * (samples.size() - 1));
+        std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+        return samples[idx];
+    }
+
+    void Record(const std::string& name, const std::string& dist, size_t n, std::vector<double>& samples, double totalNs, size_t totalOps) {
+        BenchResult r;
+        r.name = name;
+        r.engine = engine;
+        r.distribution = dist;
+        r.n = n;
+        r.samples = samples.size();
+        r.meanNs = samples.empty() ? 0 : totalNs / samples.size();
+        r.opsPerSec = totalNs > 0 ? totalOps / (totalNs * 1e-9) : 0;
+        r.p50Ns = Percentile(samples, 0.5);
+        r.p99Ns = Percentile(samples, 0.99);
+        r.bytesPerElement = 0;
+        results.push_back(r);
+
+        std::cout << engine << " " << name << " [" << dist << ", n=" << n << "]: p50 " << r.p50Ns << " ns, p99 " << r.p99Ns
+            << " ns, " << r.opsPerSec << " ops/s\n";
+    }
+
+public:
+    BenchSuite(int warmups_ = 1, int repetitions_ = 5) : warmups(warmups_), repetitions(repetitions_), engine("BinaryTree") {
+        if (repetitions <= 0 || warmups < 0) throw Errors::InvalidArgument("Repetitions must be positive.");
+    }
+
+    // setup() builds fresh state for each run (untimed); op(state, i) is timed for i in [0, ops).
+    template<typename Setup, typename Op>
+    void Point(const std::string& name, const std::string& dist, size_t n, size_t ops, Setup setup, Op op) {
+        std::vector<double> samples;
+        samples.reserve(ops * repetitions);
+        double total = 0;
+
+        for (int rep = -warmups; rep < repetitions; ++rep) {
+            auto state = setup();
+            for (size_t i = 0; i < ops; ++i) {
+                auto t1 = std::chrono::steady_clock::now();
+                op(state, i);
+                auto t2 = std::chrono::steady_clock::now();
+                if (rep >= 0) {
+                    samples.push_back(Nanos(t1, t2));
+                    total += samples.back();
+                }
+            }
+        }
+
+        Record(name, dist, n, samples, total, ops * repetitions);
+    }
+
+    // op(state) is timed as a whole; throughput is reported in elements (n) per second.
+    template<typename Setup, typename Op>
+    void Bulk(const std::string& name, const std::string& dist, size_t n, Setup setup, Op op) {
+        std::vector<double> samples;
+        double total = 0;
+
+        for (int rep = -warmups; rep < repetitions; ++rep) {
+            auto state = setup();
+            auto t1 = std::chrono::steady_clock::now();
+            op(state);
+            auto t2 = std::chrono::steady_clock::now();
+            if (rep >= 0) {
+                samples.push_back(Nanos(t1, t2));
+                total += samples.back();
+            }
+        }
+
+        Record(name, dist, n, samples, total, n * repetitions);
+    }
+
+    void SetEngine(const std::string& name) { engine = name; }
+
+    // A row without timings that only carries the heap bytes per element of a container.
+    void Memory(const std::string& dist, size_t n, size_t bytes) {
+        BenchResult r{ "memory", engine, dist, n, 0, 0, 0, 0, 0, n ? static_cast<double>(bytes) / n : 0 };
+        results.push_back(r);
+        std::cout << engine << " memory [" << dist << ", n=" << n << "]: " << r.bytesPerElement << " bytes/element\n";
+    }
+
+    // Throughput (or, for memory rows, footprint) of r relative to BinaryTree on the same
+    // workload; 0 if there is no BinaryTree row to compare with.
+    double Relative(const BenchResult& r) const {
+        for (const auto& base : results) {
+            if (base.engine != "BinaryTree" || base.name != r.name || base.distribution != r.distribution || base.n != r.n) continue;
+            if (r.name == "memory") return base.bytesPerElement > 0 ? r.bytesPerElement / base.bytesPerElement : 0;
+            return base.opsPerSec > 0 ? r.opsPerSec / base.opsPerSec : 0;
+        }
+        return 0;
+    }
+
+    const std::vector<BenchResult>& Results() const { return results; }
+
+    void WriteCsv(const std::string& filename) const {
+        std::ofstream file(filename);
+        if (!file) throw Errors::FileError(filename);
+        file << "Benchmark,Engine,Distribution,N,Samples,P50Ns,P99Ns,MeanNs,OpsPerSec,BytesPerElement,VsBinaryTree\n";
+        for (const auto& r : results) {
+            file << r.name << "," << r.engine << "," << r.distribution << "," << r.n << "," << r.samples << "," << r.p50Ns << ","
+                << r.p99Ns << "," << r.meanNs << "," << r.opsPerSec << "," << r.bytesPerElement << "," << Relative(r) << "\n";
+        }
+    }
+
+    void WriteJson(const std::string& filename) const {
+        std::ofstream file(filename);
+        if (!file) throw Errors::FileError(filename);
+        file << "[\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto& r = results[i];
+            file << "  {\"benchmark\": \"" << r.name << "\", \"engine\": \"" << r.engine << "\", \"distribution\": \""
+                << r.distribution << "\", \"n\": " << r.n << ", \"samples\": " << r.samples << ", \"p50_ns\": " << r.p50Ns
+                << ", \"p99_ns\": " << r.p99Ns << ", \"mean_ns\": " << r.meanNs << ", \"ops_per_sec\": " << r.opsPerSec
+                << ", \"bytes_per_element\": " << r.bytesPerElement << ", \"vs_binary_tree\": " << Relative(r) << "}"
+                << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        file << "]\n";
+    }
+};
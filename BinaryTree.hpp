@@ -6,64 +6,229 @@
 #include <functional>
 #include <stdexcept>
 #include "error.hpp"
+#include "Codec.hpp"
+#include "Stats.hpp"
+#include "Memory.hpp"
+#include "Augment.hpp"
 #include <iomanip>
 #include <vector>
-
-template<typename T>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <unordered_map>
+#include <algorithm>
+#include <climits>
+
+// Binary search tree of T values ordered by keys of type K (int unless given). Keys are
+// stored once per node, inline, and compared only through Compare. Augment (see Augment.hpp)
+// adds a cached subtree aggregate to every node for aggregate(lo, hi).
+template<typename T, typename K = int, typename Compare = std::less<>, typename Augment = NoAugment>
 class BinaryTree {
+public:
+    using Aggregate = typename Augment::Value;
+
+    // Key-level changes that turn one tree into another.
+    struct Diff {
+        std::vector<std::pair<K, T>> inserted;
+        std::vector<K> removed;
+        std::vector<std::pair<K, T>> changed;
+
+        bool empty() const { return inserted.empty() && removed.empty() && changed.empty(); }
+        void toBinary(std::string& out) const;
+        static Diff fromBinary(const std::string& bytes, size_t& pos);
+    };
+
 private:
-    struct Node {
-        int key;
+    struct Node : AugmentSlot<Augment> {
+        K key;
         T value;
         Node* left;
         Node* right;
+        unsigned version : 31;
+        unsigned dead : 1;     // tombstone left by remove() in lazy deletion mode
+        int height;
 
-        Node(int k, const T& v) : key(k), value(v), left(nullptr), right(nullptr) {}
+        Node(const K& k, const T& v) : key(k), value(v), left(nullptr), right(nullptr), version(0), dead(0), height(1) {}
     };
 
     Node* root;
-    int size;
-
-    void destroy(Node* node);
+    int size;          // live keys
+    int heightLimit;
+
+    // Lazy deletion. With tombstoneLimit > 0, remove() only marks the node dead; searches and
+    // traversals skip dead nodes, and once they make up more than tombstoneLimit of all nodes
+    // compact() frees them in one rebuild. Any rebuild (balance(), the height bound) drops
+    // them as well.
+    int tombstones;
+    double tombstoneLimit;
+
+    // Checkpoint state. While a checkpoint runs, nodes older than `version` belong to the
+    // snapshot as well: insert/remove copy them instead of writing, and retire instead of deleting.
+    unsigned version;
+    bool checkpointing;
+    std::atomic<bool> checkpointDone;
+    std::thread checkpointThread;
+    std::exception_ptr checkpointError;
+    std::vector<Node*> retired;
+
+    Node* createNode(const K& key, const T& value) const;
+    Node* writable(Node* node);
+    void release(Node* node);
+    void finishCheckpoint();
+
+    // Every node caches its height. Subtree hashes, for containsSubtree() and diff(), live in
+    // `hashes` beside the nodes so that trees which never compare do not pay for them: without
+    // enableHashing() they are computed on first use and dropped by the next change, with it
+    // every change keeps them current. Per node they hold the hash of its value (reused until
+    // the value changes) and a hash of the values and shape of its subtree, the things equals()
+    // compares; the digest used by diff() also covers the keys.
+    // hashIndex maps subtree hashes to nodes; it is built by the first containsSubtree().
+    struct NodeHashes {
+        size_t value;
+        size_t keyed;   // value and key
+        size_t hash;
+        size_t digest;
+    };
+    mutable std::unordered_map<const Node*, NodeHashes> hashes;
+    mutable bool hashesValid;
+    bool hashing;
+    mutable std::unordered_multimap<size_t, Node*> hashIndex;
+    mutable bool hashIndexed;
+
+    static constexpr bool augmented = !std::is_same_v<Augment, NoAugment>;
+
+    size_t hashOf(Node* node) const;
+    size_t digestOf(Node* node) const;
+    static Aggregate aggregateOf(Node* node);
+    static void refresh(Node* node);
+    static void refreshAll(Node* node);
+    void hashNode(Node* node) const;
+    void unhash(Node* node);
+    void ensureHashes() const;
+    void dropHashes() const;
+    void update(Node* node);
+    void unindex(Node* node) const;
+    void resetIndex();
+
+    // Optional value -> node index for containsNode/findByRelativePath, keyed by ValueHash<T>.
+    std::unordered_multimap<size_t, Node*> valueIndex;
+    bool valueIndexed;
+
+    void indexValue(Node* node);
+    void unindexValue(Node* node);
+    void rebuildValueIndex();
+    Node* findValue(const T& value) const;
+
+    // Optional hot-key cache in front of search(const K&): a direct-mapped table of recently
+    // found nodes. A slot changes hands only after as many colliding lookups as it had hits,
+    // so a stream of cold keys does not push the hot ones out. Nodes leave it when freed or
+    // copied (release/writable); split, join and assignment clear it.
+    struct HotSlot {
+        Node* node = nullptr;
+        unsigned hits = 0;
+    };
+    static const unsigned HOT_HITS_MAX = 15;
+    mutable std::vector<HotSlot> hotSlots;
+
+    HotSlot& hotSlot(const K& key) const;
+    Node* searchHot(const K& key) const;
+    void forgetHot(Node* node);
+    void clearHot();
+
+    // Optional Bloom filter over the keys, checked by search(const K&) before the walk. It is
+    // blocked: all bits of a key sit in one 64-byte block, so a definite miss costs one cache
+    // line. Inserts add keys; removed keys stay in it until rebuildFilter(), which balance()
+    // and split/join run. A rebuild sizes it for twice the live keys and it regrows once full.
+    std::vector<uint64_t> filter;
+    size_t filterKeys;          // keys added since the last rebuild
+    size_t filterCapacity;      // keys it was sized for
+    unsigned filterBitsPerKey;  // 0 - no filter
+
+    static const unsigned FILTER_WORDS = 8;     // words per block
+    static const unsigned FILTER_PROBES = 6;
+
+    static uint64_t filterHash(const K& key);
+    void filterAdd(const K& key);
+    bool filterMayContain(const K& key) const;
+    void rebuildFilter();
+    Node* lookup(const K& key) const;
+
+#ifdef BINARYTREE_STATS
+    mutable TreeStats counters;
+#endif
+
+    // Keys are ordered by Compare alone: two keys are the same when neither is less. A
+    // transparent Compare (std::less<> by default) also compares K with other types, which
+    // lets search() take e.g. a std::string_view for std::string keys without building a K.
+    template<typename A, typename B>
+    static bool keyLess(const A& a, const B& b) { return Compare{}(a, b); }
+    template<typename A, typename B>
+    static bool keyEqual(const A& a, const B& b) { return !Compare{}(a, b) && !Compare{}(b, a); }
+
+    static void destroy(Node* node);
     Node* copy(Node* node) const;
-    Node* insert(Node* node, int key, const T& value);
-    Node* remove(Node* node, int key, bool& success);
-    Node* search(Node* node, int key) const;
+    Node* insert(Node* node, const K& key, const T& value);
+    Node* remove(Node* node, const K& key, bool& success, bool evenDead = false);
+    Node* bury(Node* node, const K& key, bool& success);
+    Node* firstLive(bool fromMax) const;
+    static Aggregate liftOf(Node* node);
+    static int countDead(Node* node);
+    template<typename Q>
+    Node* search(Node* node, const Q& key) const;
     Node* getMinNode(Node* node) const;
     Node* getMaxNode(Node* node) const;
 
     void traverse(Node* node, const std::string& order, std::function<void(const T&)> func) const;
-    void traverse(std::function<void(int, const T&)> func) const;
-    void traverse(Node* node, std::function<void(int, const T&)> func) const;
+    void traverse(std::function<void(const K&, const T&)> func) const;
+    void traverse(Node* node, std::function<void(const K&, const T&)> func) const;
 
 
     bool equals(Node* a, Node* b) const;
-    bool containsSubtree(Node* root, Node* sub) const;
     Node* find(Node* node, const T& value) const;
 
-    Node* buildBalancedTree(const std::vector<std::pair<int, T>>& nodes, int start, int end);
-    void inOrderCollect(Node* node, std::vector<std::pair<int, T>>& out) const;
-
-    int getDepth(Node* node) const;
+    Node* linkBalanced(std::vector<Node*>& nodes, int start, int end);
+    Node* rebuild(Node* node);
+    void rebuildPath(const K& key);
+    static int countNodes(Node* node, int limit = INT_MAX);
+
+    // split/join: nodes are relinked, never copied. joinWith() hangs `mid` between two trees
+    // whose keys are on either side of it, descending the taller one by cached height and
+    // rotating on the way back (an AVL join), so AVL-shaped inputs give AVL-shaped results.
+    Node* rotateLeft(Node* node);
+    Node* rotateRight(Node* node);
+    Node* rebalance(Node* node);
+    Node* joinWith(Node* left, Node* mid, Node* right);
+    Node* detachMin(Node* node, Node*& min);
+    void splitNode(Node* node, const K& key, Node*& less, Node*& greater, bool keepEqual = false);
+    void inOrderCollect(Node* node, std::vector<std::pair<K, T>>& out) const;
+    void diffNodes(Node* a, const BinaryTree& target, Node* b, Diff& out) const;
+
+    static int getDepth(Node* node);
 
     void printNode(Node* node, int indent) const;
 
 
-    std::string serializeNode(Node* node) const;
+    void serializeNode(Node* node, std::string& out) const;
     static Node* parseNode(const std::string& s, size_t& pos);
+    static size_t writeBinary(Node* node, std::ostream& os);
+    static Node* buildSorted(const std::vector<K>& keys, const std::vector<T>& values, size_t lo, size_t hi, unsigned threads);
 
-    bool isValidBST(Node* node, const int* minKey, const int* maxKey) const;
+    bool isValidBST(Node* node, const K* minKey, const K* maxKey) const;
 
 
 
 public:
     BinaryTree();
-    BinaryTree(const BinaryTree<T>& other);
+    BinaryTree(const BinaryTree& other);
     ~BinaryTree();
 
-    void insert(int key, const T& value);
-    bool remove(int key);
-    T* search(int key) const;
+    void insert(const K& key, const T& value);
+    bool remove(const K& key);
+    int removeRange(const K& lo, const K& hi);
+    int removeIf(std::function<bool(const T&)> pred);
+    T* search(const K& key) const;
+    template<typename Q, typename C = Compare, typename = typename C::is_transparent>
+    T* search(const Q& key) const;
     T getMin() const;
     T getMax() const;
 
@@ -73,215 +238,893 @@ public:
     void traverseLKP(std::function<void(const T&)> func) const;
     void traversePLK(std::function<void(const T&)> func) const;
     void traversePKL(std::function<void(const T&)> func) const;
+    void traverseRange(const K& lo, const K& hi, std::function<void(const K&, const T&)> func) const;
+
+    BinaryTree map(std::function<T(const T&)> f) const;
+    BinaryTree where(std::function<bool(const T&)> p) const;
+    BinaryTree merge(const BinaryTree& other) const;
+    BinaryTree extractSubtree(const K& key) const;
+    // split() relinks in O(height) but counts the smaller side to keep both sizes exact, so it
+    // costs O(min(|less|, |greater|)) in all, not O(log n); join() relinks in O(height). Side
+    // structures are not split or merged node by node: split() compacts tombstones first, and
+    // both rebuild the subtree hashes, the value index and the key filter of both trees when
+    // those are enabled. With any of them in use, split() and join() are O(n).
+    BinaryTree split(const K& key);
+    void join(BinaryTree& greater);
+
+    bool containsSubtree(const BinaryTree& sub) const;
+    bool containsNode(const T& value) const;
 
-    BinaryTree<T> map(std::function<T(const T&)> f) const;
-    BinaryTree<T> where(std::function<bool(const T&)> p) const;
-    BinaryTree<T> merge(const BinaryTree<T>& other) const;
-    BinaryTree<T> extractSubtree(int key) const;
+    // Keep subtree hashes current on every change, for repeated containsSubtree()/diff() on a
+    // changing tree. Off, they are computed by the first such call after a change.
+    void enableHashing(bool enabled = true);
+    bool hashingEnabled() const;
 
-    bool containsSubtree(const BinaryTree<T>& sub) const;
-    bool containsNode(const T& value) const;
+    void enableValueIndex(bool enabled = true);
+    bool valueIndexEnabled() const;
+    size_t valueIndexMemory() const;
+
+    // With the hot-key cache on, search(const K&) writes to the cache and is no longer safe
+    // to call from several threads at once. 0 slots turns it off; other counts round up to a
+    // power of two.
+    void enableHotCache(size_t slots = 1024);
+    size_t hotCacheSlots() const;
+
+    // Bloom filter that answers most searches for absent keys without touching the nodes;
+    // about 1% false positives at 10 bits per key, 0 bits turns it off. After a bulk load
+    // (fromSorted, fromBinary) enable it on the loaded tree.
+    void enableKeyFilter(unsigned bitsPerKey = 10);
+    bool keyFilterEnabled() const;
+    size_t keyFilterMemory() const;
+
+    TreeStats stats() const;
+    void resetStats();
+    MemoryUsage memoryUsage() const;
+
+    Diff diff(const BinaryTree& target) const;
+    void patch(const Diff& d);
+    size_t digest() const;
+
+    Aggregate aggregate() const;
+    Aggregate aggregate(const K& lo, const K& hi) const;
 
 
     void balance();
     int GetDepth() const;
+    // insert() keeps the height at most `bound`, 0 turns it off. A bound of b holds 2^b - 1 keys,
+    // so it must hold the current size; keys inserted beyond that are no longer rebuilt under it.
+    void setHeightBound(int bound);
+    int heightBound() const;
+
+    void setTombstoneRatio(double ratio);
+    double tombstoneRatio() const;
+    int tombstoneCount() const;
+    void compact();
 
     void PrintTree() const;
 
-    BinaryTree<T>& operator=(const BinaryTree<T>& other);
-    bool operator==(const BinaryTree<T>& other) const;
-    bool operator!=(const BinaryTree<T>& other) const;
+    BinaryTree& operator=(const BinaryTree& other);
+    bool operator==(const BinaryTree& other) const;
+    bool operator!=(const BinaryTree& other) const;
 
 
     std::string toString() const;
-    static BinaryTree<T> fromString(const std::string& str);
+    static BinaryTree fromString(const std::string& str);
     bool isValidTreeString(const std::string& s);
 
+    void toBinary(std::ostream& os) const;
+    static BinaryTree fromBinary(const std::string& bytes);
+    static BinaryTree fromSorted(const std::vector<K>& keys, const std::vector<T>& values, unsigned threads = 1);
+
+    void checkpoint(const std::string& filename);
+    bool checkpointRunning() const;
+    void waitCheckpoint();
+
+    // Paths step through tombstones like any other node but never end on one.
     T* findByPath(const std::string& path) const;
     T* findByRelativePath(const std::string& path, const T& from) const;
 
-    static typename BinaryTree<T>::Node* recovery(std::vector<T>& KLP, std::vector<T>& LKP);
-    static BinaryTree<T> recoveryTree(const std::string& KLP_str, const std::string& LKP_str);
+    static Node* recovery(std::vector<T>& KLP, std::vector<T>& LKP);
+    static BinaryTree recoveryTree(const std::string& KLP_str, const std::string& LKP_str);
+    static BinaryTree recoveryFromKLP(const std::string& KLP_str);
+    static BinaryTree recoveryFromLPK(const std::string& LPK_str);
 };
 
+// Int-keyed tree with a subtree aggregate, e.g. AugmentedTree<double, RangeStats<double>>.
+template<typename T, typename Augment>
+using AugmentedTree = BinaryTree<T, int, std::less<>, Augment>;
 
 
-template<typename T>
-BinaryTree<T>::BinaryTree() : root(nullptr), size(0) {}
 
-template<typename T>
-BinaryTree<T>::BinaryTree(const BinaryTree<T>& other) : root(copy(other.root)), size(other.size) {}
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment>::BinaryTree()
+    : root(nullptr), size(0), heightLimit(0), tombstones(0), tombstoneLimit(0), version(0), checkpointing(false), checkpointDone(false), hashesValid(false), hashing(false), hashIndexed(false), valueIndexed(false),
+    filterKeys(0), filterCapacity(0), filterBitsPerKey(0) {}
 
-template<typename T>
-BinaryTree<T>::~BinaryTree() {
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment>::BinaryTree(const BinaryTree<T, K, Compare, Augment>& other)
+    : root(nullptr), size(other.size), heightLimit(other.heightLimit), tombstones(other.tombstones), tombstoneLimit(other.tombstoneLimit), version(0), checkpointing(false), checkpointDone(false), hashesValid(false), hashing(other.hashing), hashIndexed(false),
+    valueIndexed(other.valueIndexed), hotSlots(other.hotSlots.size()), filter(other.filter), filterKeys(other.filterKeys),
+    filterCapacity(other.filterCapacity), filterBitsPerKey(other.filterBitsPerKey) {
+    // Copied here rather than in the initializer list, so that counters exist to count the nodes.
+    root = copy(other.root);
+    rebuildValueIndex();
+    if (hashing) ensureHashes();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment>::~BinaryTree() {
+    finishCheckpoint();
     destroy(root);
 }
 
-template<typename T>
-void BinaryTree<T>::destroy(Node* node) {
-    if (!node) return;
-    destroy(node->left);
-    destroy(node->right);
-    delete node;
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::createNode(const K& key, const T& value) const {
+    Node* node = new Node(key, value);
+    node->version = version;
+    TREE_STAT(++counters.allocations;)
+    return node;
 }
 
-template<typename T>
-typename BinaryTree<T>::Node* BinaryTree<T>::insert(Node* node, int key, const T& value) {
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::writable(Node* node) {
+    if (!checkpointing || node->version == version) return node;
+    Node* fresh = createNode(node->key, node->value);
+    fresh->left = node->left;
+    fresh->right = node->right;
+    fresh->height = node->height;
+    fresh->dead = node->dead;
+    if constexpr (augmented) fresh->aggregate = node->aggregate;
+    if (hashing) {
+        auto it = hashes.find(node);
+        if (it != hashes.end()) {
+            NodeHashes moved = it->second;
+            unhash(node);
+            hashes.emplace(fresh, moved);
+        }
+    }
+    else if (hashesValid) dropHashes();
+    unindexValue(node);
+    forgetHot(node);
+    indexValue(fresh);
+    retired.push_back(node);
+    return fresh;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::release(Node* node) {
+    if (hashing) unhash(node);
+    else if (hashesValid) dropHashes();
+    unindexValue(node);
+    forgetHot(node);
+    if (checkpointing && node->version != version) retired.push_back(node);
+    else {
+        delete node;
+        TREE_STAT(++counters.frees;)
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+size_t BinaryTree<T, K, Compare, Augment>::hashOf(Node* node) const {
+    return node ? hashes.find(node)->second.hash : 0x6a09e667f3bcc908ULL;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+size_t BinaryTree<T, K, Compare, Augment>::digestOf(Node* node) const {
+    return node ? hashes.find(node)->second.digest : 0x3c6ef372fe94f82bULL;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Aggregate BinaryTree<T, K, Compare, Augment>::aggregateOf(Node* node) {
+    if constexpr (augmented) return node ? node->aggregate : Augment::identity();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Aggregate BinaryTree<T, K, Compare, Augment>::liftOf(Node* node) {
+    if constexpr (augmented) return node->dead ? Augment::identity() : Augment::lift(node->value);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::refresh(Node* node) {
+    node->height = 1 + std::max(getDepth(node->left), getDepth(node->right));
+    if constexpr (augmented) {
+        node->aggregate = Augment::combine(aggregateOf(node->left), Augment::combine(liftOf(node), aggregateOf(node->right)));
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::refreshAll(Node* node) {
+    std::vector<std::pair<Node*, bool>> stack;
+    if (node) stack.push_back({ node, false });
+    while (!stack.empty()) {
+        auto [cur, visited] = stack.back();
+        stack.pop_back();
+        if (visited) {
+            refresh(cur);
+            continue;
+        }
+        stack.push_back({ cur, true });
+        if (cur->left) stack.push_back({ cur->left, false });
+        if (cur->right) stack.push_back({ cur->right, false });
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::hashNode(Node* node) const {
+    // Children first: their entries must be current.
+    auto [entry, fresh] = hashes.try_emplace(node);
+    NodeHashes& h = entry->second;
+    if (fresh) {
+        // A dead node's value is stale, so only the fact that it is dead goes into the hashes.
+        h.value = node->dead ? 0x510e527fade682d1ULL : ValueHash<T>{}(node->value);
+        h.keyed = Codecs::HashMix(h.value ^ Codecs::HashMix(ValueHash<K>{}(node->key)));
+    }
+
+    uint64_t x = Codecs::HashMix(h.value ^ (hashOf(node->left) + 0x9e3779b97f4a7c15ULL));
+    x = Codecs::HashMix(x ^ (hashOf(node->right) + 0xbb67ae8584caa73bULL));
+    h.hash = static_cast<size_t>(x);
+
+    uint64_t d = Codecs::HashMix(h.keyed ^ (digestOf(node->left) + 0x9e3779b97f4a7c15ULL));
+    d = Codecs::HashMix(d ^ (digestOf(node->right) + 0xbb67ae8584caa73bULL));
+    h.digest = static_cast<size_t>(d);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::unhash(Node* node) {
+    // The node is freed or its key, value or liveness changed; the next update() rehashes it.
+    unindex(node);
+    hashes.erase(node);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::ensureHashes() const {
+    if (hashesValid) return;
+    dropHashes();
+    hashes.reserve(size + tombstones);
+    std::vector<std::pair<Node*, bool>> stack;
+    if (root) stack.push_back({ root, false });
+    while (!stack.empty()) {
+        auto [cur, visited] = stack.back();
+        stack.pop_back();
+        if (visited) {
+            hashNode(cur);
+            continue;
+        }
+        stack.push_back({ cur, true });
+        if (cur->left) stack.push_back({ cur->left, false });
+        if (cur->right) stack.push_back({ cur->right, false });
+    }
+    hashesValid = true;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::dropHashes() const {
+    hashes.clear();
+    hashesValid = false;
+    hashIndex.clear();
+    hashIndexed = false;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::update(Node* node) {
+    refresh(node);
+    if (hashing) {
+        unindex(node);
+        hashNode(node);
+        if (hashIndexed) hashIndex.emplace(hashOf(node), node);
+    }
+    else if (hashesValid) dropHashes();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::unindex(Node* node) const {
+    if (!hashIndexed) return;
+    auto entry = hashes.find(node);
+    if (entry == hashes.end()) return;
+    auto range = hashIndex.equal_range(entry->second.hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == node) {
+            hashIndex.erase(it);
+            return;
+        }
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::enableHashing(bool enabled) {
+    hashing = enabled;
+    if (enabled) ensureHashes();
+    else {
+        dropHashes();
+        hashes.rehash(0);
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::hashingEnabled() const {
+    return hashing;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::resetIndex() {
+    hashIndex.clear();
+    hashIndexed = false;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::indexValue(Node* node) {
+    if (!valueIndexed || node->dead) return;
+    valueIndex.emplace(ValueHash<T>{}(node->value), node);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::unindexValue(Node* node) {
+    if (!valueIndexed || node->dead) return;
+    auto range = valueIndex.equal_range(ValueHash<T>{}(node->value));
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == node) {
+            valueIndex.erase(it);
+            return;
+        }
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::rebuildValueIndex() {
+    valueIndex.clear();
+    if (!valueIndexed) return;
+
+    valueIndex.reserve(size);
+    std::vector<Node*> stack;
+    if (root) stack.push_back(root);
+    while (!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        indexValue(node);
+        if (node->left) stack.push_back(node->left);
+        if (node->right) stack.push_back(node->right);
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::findValue(const T& value) const {
+    if (!valueIndexed) return find(root, value);
+
+    auto range = valueIndex.equal_range(ValueHash<T>{}(value));
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->value == value) return it->second;
+    }
+    return nullptr;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::enableValueIndex(bool enabled) {
+    valueIndexed = enabled;
+    rebuildValueIndex();
+    if (!enabled) valueIndex.rehash(0);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::valueIndexEnabled() const {
+    return valueIndexed;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+size_t BinaryTree<T, K, Compare, Augment>::valueIndexMemory() const {
+    if (!valueIndexed) return 0;
+    size_t entry = sizeof(void*) + sizeof(typename decltype(valueIndex)::value_type);
+    return sizeof(valueIndex) + valueIndex.bucket_count() * sizeof(void*) + valueIndex.size() * entry;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::HotSlot& BinaryTree<T, K, Compare, Augment>::hotSlot(const K& key) const {
+    return hotSlots[Codecs::HashMix(ValueHash<K>{}(key)) & (hotSlots.size() - 1)];
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::searchHot(const K& key) const {
+    HotSlot& slot = hotSlot(key);
+    if (slot.node && keyEqual(slot.node->key, key)) {
+        TREE_STAT(++counters.hotHits;)
+        if (slot.hits < HOT_HITS_MAX) ++slot.hits;
+        return slot.node;
+    }
+    Node* found = lookup(key);
+    if (found && !found->dead) {
+        if (slot.hits == 0) {
+            slot.node = found;
+            slot.hits = 1;
+        }
+        else --slot.hits;
+    }
+    return found;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::forgetHot(Node* node) {
+    if (hotSlots.empty()) return;
+    HotSlot& slot = hotSlot(node->key);
+    if (slot.node == node) slot = HotSlot();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::clearHot() {
+    std::fill(hotSlots.begin(), hotSlots.end(), HotSlot());
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::enableHotCache(size_t slots) {
+    size_t rounded = 0;
+    if (slots) for (rounded = 1; rounded < slots; rounded <<= 1) {}
+    hotSlots.assign(rounded, HotSlot());
+    hotSlots.shrink_to_fit();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+size_t BinaryTree<T, K, Compare, Augment>::hotCacheSlots() const {
+    return hotSlots.size();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+uint64_t BinaryTree<T, K, Compare, Augment>::filterHash(const K& key) {
+    return Codecs::HashMix(ValueHash<K>{}(key) + 0x9e3779b97f4a7c15ULL);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::filterAdd(const K& key) {
+    if (++filterKeys > filterCapacity) {
+        rebuildFilter();
+        return;
+    }
+    // The low half of the hash picks the block, a remix of it the 9-bit offsets inside.
+    uint64_t h = filterHash(key);
+    uint64_t* block = &filter[((h & 0xffffffffULL) * (filter.size() / FILTER_WORDS) >> 32) * FILTER_WORDS];
+    uint64_t bits = Codecs::HashMix(h);
+    for (unsigned i = 0; i < FILTER_PROBES; ++i, bits >>= 9) block[(bits >> 6) & 7] |= uint64_t(1) << (bits & 63);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::filterMayContain(const K& key) const {
+    uint64_t h = filterHash(key);
+    const uint64_t* block = &filter[((h & 0xffffffffULL) * (filter.size() / FILTER_WORDS) >> 32) * FILTER_WORDS];
+    uint64_t bits = Codecs::HashMix(h);
+    for (unsigned i = 0; i < FILTER_PROBES; ++i, bits >>= 9) {
+        if (!(block[(bits >> 6) & 7] & (uint64_t(1) << (bits & 63)))) return false;
+    }
+    return true;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::rebuildFilter() {
+    filter.clear();
+    filterKeys = 0;
+    if (!filterBitsPerKey) {
+        filter.shrink_to_fit();
+        filterCapacity = 0;
+        return;
+    }
+    filterCapacity = std::max<size_t>(2 * static_cast<size_t>(size), 64);
+    size_t blocks = (filterCapacity * filterBitsPerKey + FILTER_WORDS * 64 - 1) / (FILTER_WORDS * 64);
+    filter.assign(blocks * FILTER_WORDS, 0);
+
+    std::vector<Node*> stack;
+    if (root) stack.push_back(root);
+    while (!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        if (!node->dead) filterAdd(node->key);
+        if (node->left) stack.push_back(node->left);
+        if (node->right) stack.push_back(node->right);
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::lookup(const K& key) const {
+    if (filterBitsPerKey && !filterMayContain(key)) {
+        TREE_STAT(++counters.filterRejects;)
+        return nullptr;
+    }
+    Node* found = search(root, key);
+    TREE_STAT(if (filterBitsPerKey && (!found || found->dead)) ++counters.filterFalsePositives;)
+    return found;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::enableKeyFilter(unsigned bitsPerKey) {
+    filterBitsPerKey = bitsPerKey;
+    rebuildFilter();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::keyFilterEnabled() const {
+    return filterBitsPerKey > 0;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+size_t BinaryTree<T, K, Compare, Augment>::keyFilterMemory() const {
+    return filter.capacity() * sizeof(uint64_t);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+TreeStats BinaryTree<T, K, Compare, Augment>::stats() const {
+    TreeStats snapshot;
+    TREE_STAT(snapshot = counters; snapshot.enabled = true;)
+    return snapshot;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::resetStats() {
+    TREE_STAT(counters = TreeStats();)
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+MemoryUsage BinaryTree<T, K, Compare, Augment>::memoryUsage() const {
+    MemoryUsage usage;
+    HeapUsage heap;
+
+    std::vector<Node*> stack;
+    if (root) stack.push_back(root);
+    while (!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        ++usage.nodes;
+        HeapBytes<K>{}(node->key, heap);
+        HeapBytes<T>{}(node->value, heap);
+        if (node->left) stack.push_back(node->left);
+        if (node->right) stack.push_back(node->right);
+    }
+
+    usage.nodeOverhead = usage.nodes * (sizeof(Node) - sizeof(T));
+    usage.valuePayload = usage.nodes * sizeof(T);
+    usage.valueHeap = heap.bytes;
+    usage.allocatorSlack = usage.nodes * Memory::Slack(sizeof(Node)) + heap.slack;
+
+    size_t entry = sizeof(void*) + sizeof(typename decltype(hashIndex)::value_type);
+    if (hashIndexed) usage.indexBytes += hashIndex.bucket_count() * sizeof(void*) + hashIndex.size() * entry;
+    size_t hashEntry = sizeof(void*) + sizeof(typename decltype(hashes)::value_type);
+    if (!hashes.empty()) usage.indexBytes += hashes.bucket_count() * sizeof(void*) + hashes.size() * hashEntry;
+    usage.indexBytes += valueIndexMemory() + keyFilterMemory();
+    return usage;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::checkpoint(const std::string& filename) {
+    waitCheckpoint();
+
+    ++version;
+    checkpointing = true;
+    checkpointDone = false;
+
+    Node* snapshot = root;
+    checkpointThread = std::thread([this, snapshot, filename]() {
+        try {
+            std::ofstream file(filename, std::ios::binary);
+            if (!file) throw Errors::FileError(filename);
+            writeBinary(snapshot, file);
+            if (!file) throw Errors::FileError(filename);
+        }
+        catch (...) {
+            checkpointError = std::current_exception();
+        }
+        checkpointDone = true;
+    });
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::checkpointRunning() const {
+    return checkpointing && !checkpointDone;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::finishCheckpoint() {
+    if (!checkpointing) return;
+    checkpointThread.join();
+    checkpointing = false;
+    for (Node* node : retired) delete node;
+    TREE_STAT(counters.frees += retired.size();)
+    retired.clear();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::waitCheckpoint() {
+    finishCheckpoint();
+    if (checkpointError) {
+        std::exception_ptr error = checkpointError;
+        checkpointError = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::destroy(Node* node) {
+    std::vector<Node*> stack;
+    if (node) stack.push_back(node);
+    while (!stack.empty()) {
+        Node* cur = stack.back();
+        stack.pop_back();
+        if (cur->left) stack.push_back(cur->left);
+        if (cur->right) stack.push_back(cur->right);
+        delete cur;
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::insert(Node* node, const K& key, const T& value) {
     if (!node) {
         ++size;
-        return new Node(key, value);
+        Node* fresh = createNode(key, value);
+        update(fresh);
+        indexValue(fresh);
+        return fresh;
     }
-    if (key < node->key) {
-        node->left = insert(node->left, key, value);
+    TREE_STAT(++counters.nodesVisited; ++counters.comparisons;)
+    if (keyLess(key, node->key)) {
+        Node* left = insert(node->left, key, value);
+        node = writable(node);
+        node->left = left;
     }
-    else if (key > node->key) {
-        node->right = insert(node->right, key, value);
+    else if (keyLess(node->key, key)) {
+        Node* right = insert(node->right, key, value);
+        node = writable(node);
+        node->right = right;
     }
     else {
+        node = writable(node);
+        if (hashing) unhash(node);
+        unindexValue(node);
         node->value = value;
+        if (node->dead) {
+            node->dead = false;
+            --tombstones;
+            ++size;
+        }
+        indexValue(node);
     }
+    update(node);
     return node;
 }
 
 
-template<typename T>
-void BinaryTree<T>::insert(int key, const T& value) {
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::insert(const K& key, const T& value) {
+    TREE_STAT(StatsTimer timer(counters.insertLatency);)
+    if (checkpointing && checkpointDone) finishCheckpoint();
+    int before = size;
     root = insert(root, key, value);
+    if (filterBitsPerKey && size > before) filterAdd(key);
+    if (heightLimit > 0 && root->height > heightLimit) rebuildPath(key);
 }
 
-template<typename T>
-typename BinaryTree<T>::Node* BinaryTree<T>::search(Node* node, int key) const {
-    if (!node) return nullptr;
-    if (key == node->key) return node;
-    if (key < node->key) return search(node->left, key);
-    return search(node->right, key);
+template<typename T, typename K, typename Compare, typename Augment>
+template<typename Q>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::search(Node* node, const Q& key) const {
+    while (node) {
+        TREE_STAT(++counters.nodesVisited; ++counters.comparisons;)
+        if (keyLess(key, node->key)) node = node->left;
+        else if (keyLess(node->key, key)) node = node->right;
+        else break;
+    }
+    return node;
 }
 
-template<typename T>
-T* BinaryTree<T>::search(int key) const {
+template<typename T, typename K, typename Compare, typename Augment>
+T* BinaryTree<T, K, Compare, Augment>::search(const K& key) const {
+    TREE_STAT(StatsTimer timer(counters.searchLatency);)
+    Node* res = hotSlots.empty() ? lookup(key) : searchHot(key);
+    return res && !res->dead ? &res->value : nullptr;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+template<typename Q, typename C, typename>
+T* BinaryTree<T, K, Compare, Augment>::search(const Q& key) const {
+    TREE_STAT(StatsTimer timer(counters.searchLatency);)
     Node* res = search(root, key);
-    return res ? &res->value : nullptr;
+    return res && !res->dead ? &res->value : nullptr;
 }
 
-template<typename T>
-typename BinaryTree<T>::Node* BinaryTree<T>::getMinNode(Node* node) const {
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::getMinNode(Node* node) const {
     if (!node) return nullptr;
     while (node->left) node = node->left;
     return node;
 }
 
-template<typename T>
-typename BinaryTree<T>::Node* BinaryTree<T>::getMaxNode(Node* node) const {
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::getMaxNode(Node* node) const {
     if (!node) return nullptr;
     while (node->right) node = node->right;
     return node;
 }
 
-template<typename T>
-T BinaryTree<T>::getMin() const {
-    Node* min = getMinNode(root);
+template<typename T, typename K, typename Compare, typename Augment>
+T BinaryTree<T, K, Compare, Augment>::getMin() const {
+    Node* min = tombstones ? firstLive(false) : getMinNode(root);
     if (!min) throw Errors::TreeEmpty();
     return min->value;
 }
 
-template<typename T>
-T BinaryTree<T>::getMax() const {
-    Node* max = getMaxNode(root);
+template<typename T, typename K, typename Compare, typename Augment>
+T BinaryTree<T, K, Compare, Augment>::getMax() const {
+    Node* max = tombstones ? firstLive(true) : getMaxNode(root);
     if (!max) throw Errors::TreeEmpty();
     return max->value;
 }
 
-template<typename T>
-typename BinaryTree<T>::Node* BinaryTree<T>::remove(Node* node, int key, bool& success) {
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::remove(Node* node, const K& key, bool& success, bool evenDead) {
     if (!node) return nullptr;
-    if (key < node->key)
-        node->left = remove(node->left, key, success);
-    else if (key > node->key)
-        node->right = remove(node->right, key, success);
+    TREE_STAT(++counters.nodesVisited; ++counters.comparisons;)
+    if (keyLess(key, node->key)) {
+        Node* left = remove(node->left, key, success, evenDead);
+        if (!success) return node;
+        node = writable(node);
+        node->left = left;
+    }
+    else if (keyLess(node->key, key)) {
+        Node* right = remove(node->right, key, success, evenDead);
+        if (!success) return node;
+        node = writable(node);
+        node->right = right;
+    }
     else {
+        if (node->dead && !evenDead) return node;
         success = true;
-        --size;
+        if (node->dead) --tombstones;
+        else --size;
         if (!node->left) {
             Node* temp = node->right;
-            delete node;
+            release(node);
             return temp;
         }
         if (!node->right) {
             Node* temp = node->left;
-            delete node;
+            release(node);
             return temp;
         }
+        // The successor moves up, tombstone or not; its own removal below counts it back.
         Node* minRight = getMinNode(node->right);
+        node = writable(node);
+        if (hashing) unhash(node);
+        unindexValue(node);
+        forgetHot(node);
         node->key = minRight->key;
         node->value = minRight->value;
-        node->right = remove(node->right, minRight->key, success);
+        node->dead = minRight->dead;
+        if (node->dead) ++tombstones;
+        else ++size;
+        indexValue(node);
+        node->right = remove(node->right, minRight->key, success, true);
     }
+    update(node);
     return node;
 }
 
-template<typename T>
-bool BinaryTree<T>::remove(int key) {
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::bury(Node* node, const K& key, bool& success) {
+    if (!node) return nullptr;
+    TREE_STAT(++counters.nodesVisited; ++counters.comparisons;)
+    if (keyLess(key, node->key)) {
+        Node* left = bury(node->left, key, success);
+        if (!success) return node;
+        node = writable(node);
+        node->left = left;
+    }
+    else if (keyLess(node->key, key)) {
+        Node* right = bury(node->right, key, success);
+        if (!success) return node;
+        node = writable(node);
+        node->right = right;
+    }
+    else {
+        if (node->dead) return node;
+        success = true;
+        node = writable(node);
+        if (hashing) unhash(node);
+        unindexValue(node);
+        node->dead = true;
+        ++tombstones;
+        --size;
+    }
+    update(node);
+    return node;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::remove(const K& key) {
+    TREE_STAT(StatsTimer timer(counters.removeLatency);)
+    if (checkpointing && checkpointDone) finishCheckpoint();
     bool success = false;
-    root = remove(root, key, success);
+    if (tombstoneLimit > 0) {
+        root = bury(root, key, success);
+        if (tombstones > tombstoneLimit * (size + tombstones)) compact();
+    }
+    else root = remove(root, key, success);
     return success;
 }
 
-template<typename T>
-void BinaryTree<T>::traverse(Node* node, const std::string& order, std::function<void(const T&)> func) const {
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::traverse(Node* node, const std::string& order, std::function<void(const T&)> func) const {
     if (!node) return;
-    if (order == "KLP") { func(node->value); traverse(node->left, order, func); traverse(node->right, order, func); }
-    else if (order == "KPL") { func(node->value); traverse(node->right, order, func); traverse(node->left, order, func); }
-    else if (order == "LPK") { traverse(node->left, order, func); traverse(node->right, order, func); func(node->value); }
-    else if (order == "LKP") { traverse(node->left, order, func); func(node->value); traverse(node->right, order, func); }
-    else if (order == "PLK") { traverse(node->right, order, func); traverse(node->left, order, func); func(node->value); }
-    else if (order == "PKL") { traverse(node->right, order, func); func(node->value); traverse(node->left, order, func); }
+    TREE_STAT(++counters.nodesVisited;)
+    auto visit = [&func](Node* n) { if (!n->dead) func(n->value); };
+    if (order == "KLP") { visit(node); traverse(node->left, order, func); traverse(node->right, order, func); }
+    else if (order == "KPL") { visit(node); traverse(node->right, order, func); traverse(node->left, order, func); }
+    else if (order == "LPK") { traverse(node->left, order, func); traverse(node->right, order, func); visit(node); }
+    else if (order == "LKP") { traverse(node->left, order, func); visit(node); traverse(node->right, order, func); }
+    else if (order == "PLK") { traverse(node->right, order, func); traverse(node->left, order, func); visit(node); }
+    else if (order == "PKL") { traverse(node->right, order, func); visit(node); traverse(node->left, order, func); }
     else throw Errors::UnknownOrder(order);
 }
 
-template<typename T>
-void BinaryTree<T>::traverse(std::function<void(int, const T&)> func) const {
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::traverse(std::function<void(const K&, const T&)> func) const {
     traverse(root, func);
 }
 
-template<typename T>
-void BinaryTree<T>::traverse(Node* node, std::function<void(int, const T&)> func) const {
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::traverse(Node* node, std::function<void(const K&, const T&)> func) const {
     if (!node) return;
-    func(node->key, node->value);
+    TREE_STAT(++counters.nodesVisited;)
+    if (!node->dead) func(node->key, node->value);
     traverse(node->left, func);
     traverse(node->right, func);
 }
 
 
-template<typename T> void BinaryTree<T>::traverseKLP(std::function<void(const T&)> func) const { traverse(root, "KLP", func); }
-template<typename T> void BinaryTree<T>::traverseKPL(std::function<void(const T&)> func) const { traverse(root, "KPL", func); }
-template<typename T> void BinaryTree<T>::traverseLPK(std::function<void(const T&)> func) const { traverse(root, "LPK", func); }
-template<typename T> void BinaryTree<T>::traverseLKP(std::function<void(const T&)> func) const { traverse(root, "LKP", func); }
-template<typename T> void BinaryTree<T>::traversePLK(std::function<void(const T&)> func) const { traverse(root, "PLK", func); }
-template<typename T> void BinaryTree<T>::traversePKL(std::function<void(const T&)> func) const { traverse(root, "PKL", func); }
+template<typename T, typename K, typename Compare, typename Augment> void BinaryTree<T, K, Compare, Augment>::traverseKLP(std::function<void(const T&)> func) const { traverse(root, "KLP", func); }
+template<typename T, typename K, typename Compare, typename Augment> void BinaryTree<T, K, Compare, Augment>::traverseKPL(std::function<void(const T&)> func) const { traverse(root, "KPL", func); }
+template<typename T, typename K, typename Compare, typename Augment> void BinaryTree<T, K, Compare, Augment>::traverseLPK(std::function<void(const T&)> func) const { traverse(root, "LPK", func); }
+template<typename T, typename K, typename Compare, typename Augment> void BinaryTree<T, K, Compare, Augment>::traverseLKP(std::function<void(const T&)> func) const { traverse(root, "LKP", func); }
+template<typename T, typename K, typename Compare, typename Augment> void BinaryTree<T, K, Compare, Augment>::traversePLK(std::function<void(const T&)> func) const { traverse(root, "PLK", func); }
+template<typename T, typename K, typename Compare, typename Augment> void BinaryTree<T, K, Compare, Augment>::traversePKL(std::function<void(const T&)> func) const { traverse(root, "PKL", func); }
 
-template<typename T>
-BinaryTree<T> BinaryTree<T>::map(std::function<T(const T&)> f) const {
-    BinaryTree<T> result;
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::traverseRange(const K& lo, const K& hi, std::function<void(const K&, const T&)> func) const {
+    // In-order over the keys in [lo, hi]; subtrees entirely below lo are never entered and the
+    // walk stops at the first key above hi.
+    std::vector<Node*> stack;
+    Node* node = root;
+    while (node || !stack.empty()) {
+        while (node) {
+            if (keyLess(node->key, lo)) node = node->right;
+            else {
+                stack.push_back(node);
+                node = node->left;
+            }
+        }
+        if (stack.empty()) return;
+        node = stack.back();
+        stack.pop_back();
+        TREE_STAT(++counters.nodesVisited;)
+        if (keyLess(hi, node->key)) return;
+        if (!node->dead) func(node->key, node->value);
+        node = node->right;
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment> BinaryTree<T, K, Compare, Augment>::map(std::function<T(const T&)> f) const {
+    BinaryTree<T, K, Compare, Augment> result;
     traverseKLP([&](const T& val) { result.insert(val, f(val)); });
     return result;
 }
 
-template<typename T>
-BinaryTree<T> BinaryTree<T>::where(std::function<bool(const T&)> p) const {
-    BinaryTree<T> result;
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment> BinaryTree<T, K, Compare, Augment>::where(std::function<bool(const T&)> p) const {
+    BinaryTree<T, K, Compare, Augment> result;
     traverseKLP([&](const T& val) {
         if (p(val)) result.insert(val, val);
         });
     return result;
 }
 
-template<typename T>
-BinaryTree<T> BinaryTree<T>::merge(const BinaryTree<T>& other) const {
-    BinaryTree<T> result;
-    traverse([&result](int key, const T& val) {
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment> BinaryTree<T, K, Compare, Augment>::merge(const BinaryTree<T, K, Compare, Augment>& other) const {
+    BinaryTree<T, K, Compare, Augment> result;
+    traverse([&result](const K& key, const T& val) {
         result.insert(key, val);
         });
-    other.traverse([&result](int key, const T& val) {
+    other.traverse([&result](const K& key, const T& val) {
         result.insert(key, val);
         });
     result.balance();
@@ -289,93 +1132,491 @@ BinaryTree<T> BinaryTree<T>::merge(const BinaryTree<T>& other) const {
 }
 
 
-template<typename T>
-typename BinaryTree<T>::Node* BinaryTree<T>::copy(Node* node) const {
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::copy(Node* node) const {
     if (!node) return nullptr;
     Node* newNode = new Node(node->key, node->value);
+    TREE_STAT(++counters.allocations;)
+    newNode->height = node->height;
+    newNode->dead = node->dead;
+    if constexpr (augmented) newNode->aggregate = node->aggregate;
     newNode->left = copy(node->left);
     newNode->right = copy(node->right);
     return newNode;
 }
 
-template<typename T>
-BinaryTree<T> BinaryTree<T>::extractSubtree(int key) const {
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment> BinaryTree<T, K, Compare, Augment>::extractSubtree(const K& key) const {
     Node* found = search(root, key);
-    if (!found) throw Errors::KeyNotFound();
-    BinaryTree<T> result;
+    if (!found || found->dead) throw Errors::KeyNotFound();
+    BinaryTree<T, K, Compare, Augment> result;
     result.root = copy(found);
+    result.tombstones = tombstones ? countDead(result.root) : 0;
+    result.tombstoneLimit = tombstoneLimit;
+    result.size = countNodes(result.root) - result.tombstones;
     return result;
 }
 
-template<typename T>
-bool BinaryTree<T>::equals(Node* a, Node* b) const {
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::rotateLeft(Node* node) {
+    Node* top = node->right;
+    node->right = top->left;
+    update(node);
+    top->left = node;
+    update(top);
+    return top;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::rotateRight(Node* node) {
+    Node* top = node->left;
+    node->left = top->right;
+    update(node);
+    top->right = node;
+    update(top);
+    return top;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::rebalance(Node* node) {
+    int hl = getDepth(node->left), hr = getDepth(node->right);
+    if (hl > hr + 1) {
+        if (getDepth(node->left->left) < getDepth(node->left->right)) node->left = rotateLeft(node->left);
+        return rotateRight(node);
+    }
+    if (hr > hl + 1) {
+        if (getDepth(node->right->right) < getDepth(node->right->left)) node->right = rotateRight(node->right);
+        return rotateLeft(node);
+    }
+    update(node);
+    return node;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::joinWith(Node* left, Node* mid, Node* right) {
+    int hl = getDepth(left), hr = getDepth(right);
+    if (hl > hr + 1) {
+        left->right = joinWith(left->right, mid, right);
+        return rebalance(left);
+    }
+    if (hr > hl + 1) {
+        right->left = joinWith(left, mid, right->left);
+        return rebalance(right);
+    }
+    mid->left = left;
+    mid->right = right;
+    update(mid);
+    return mid;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::detachMin(Node* node, Node*& min) {
+    if (!node->left) {
+        min = node;
+        Node* rest = node->right;
+        node->right = nullptr;
+        return rest;
+    }
+    node->left = detachMin(node->left, min);
+    return rebalance(node);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::splitNode(Node* node, const K& key, Node*& less, Node*& greater, bool keepEqual) {
+    // less gets the keys below `key`, or up to and including it with keepEqual.
+    if (!node) {
+        less = greater = nullptr;
+        return;
+    }
+    TREE_STAT(++counters.nodesVisited; ++counters.comparisons;)
+    if (keepEqual ? !keyLess(key, node->key) : keyLess(node->key, key)) {
+        Node* middle;
+        splitNode(node->right, key, middle, greater, keepEqual);
+        less = joinWith(node->left, node, middle);
+    }
+    else {
+        Node* middle;
+        splitNode(node->left, key, less, middle, keepEqual);
+        greater = joinWith(middle, node, node->right);
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment> BinaryTree<T, K, Compare, Augment>::split(const K& key) {
+    // Keys below `key` stay here, the rest move to the result. O(height) relinking; keeping
+    // both sizes exact costs a count of the smaller side. A running checkpoint is waited for
+    // first, since the moved nodes may still belong to its snapshot. Tombstones are compacted
+    // away first so the sizes stay node counts.
+    finishCheckpoint();
+    if (tombstones) compact();
+    resetIndex();
+    clearHot();
+    // The moved nodes' hashes would stay in this tree's table; both sides rehash instead.
+    bool rehash = hashing;
+    hashing = false;
+    dropHashes();
+
+    BinaryTree<T, K, Compare, Augment> result;
+    result.heightLimit = heightLimit;
+    result.tombstoneLimit = tombstoneLimit;
+    if (hotCacheSlots()) result.enableHotCache(hotCacheSlots());
+    Node* less;
+    splitNode(root, key, less, result.root);
+    root = less;
+
+    int half = size / 2;
+    int lessCount = countNodes(root, half + 1);
+    if (lessCount <= half) result.size = size - lessCount;
+    else result.size = countNodes(result.root);
+    size -= result.size;
+
+    result.valueIndexed = valueIndexed;
+    rebuildValueIndex();
+    result.rebuildValueIndex();
+    result.filterBitsPerKey = filterBitsPerKey;
+    if (filterBitsPerKey) {
+        rebuildFilter();
+        result.rebuildFilter();
+    }
+    if (rehash) {
+        enableHashing();
+        result.enableHashing();
+    }
+    if (heightLimit > 0 && GetDepth() > heightLimit) balance();
+    if (heightLimit > 0 && result.GetDepth() > heightLimit) result.balance();
+    return result;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+int BinaryTree<T, K, Compare, Augment>::removeRange(const K& lo, const K& hi) {
+    // Cuts [lo, hi] out with two splits, frees it and joins what is left: O(height + removed).
+    if (!root || keyLess(hi, lo)) return 0;
+    finishCheckpoint();
+    resetIndex();
+
+    Node *less, *rest, *middle, *greater;
+    splitNode(root, lo, less, rest);
+    splitNode(rest, hi, middle, greater, true);
+
+    int removed = 0;
+    std::vector<Node*> stack;
+    if (middle) stack.push_back(middle);
+    while (!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        if (node->left) stack.push_back(node->left);
+        if (node->right) stack.push_back(node->right);
+        if (node->dead) --tombstones;
+        else ++removed;
+        release(node);
+    }
+
+    if (greater) {
+        Node* mid;
+        Node* right = detachMin(greater, mid);
+        root = joinWith(less, mid, right);
+    }
+    else root = less;
+    size -= removed;
+    if (heightLimit > 0 && GetDepth() > heightLimit) balance();
+    return removed;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+int BinaryTree<T, K, Compare, Augment>::removeIf(std::function<bool(const T&)> pred) {
+    // One in-order pass sorts the nodes into kept and removed; the kept ones are relinked into
+    // a balanced tree, as by balance(). pred runs on every node before anything is changed,
+    // so an exception from it leaves the tree as it was.
+    std::vector<Node*> kept, dropped;
+    std::vector<Node*> stack;
+    Node* node = root;
+    while (node || !stack.empty()) {
+        while (node) {
+            stack.push_back(node);
+            node = node->left;
+        }
+        node = stack.back();
+        stack.pop_back();
+        TREE_STAT(++counters.nodesVisited;)
+        (node->dead || pred(node->value) ? dropped : kept).push_back(node);
+        node = node->right;
+    }
+    if (dropped.empty()) return 0;
+
+    finishCheckpoint();
+    resetIndex();
+    int removed = static_cast<int>(dropped.size()) - tombstones;
+    for (Node* gone : dropped) release(gone);
+    size -= removed;
+    tombstones = 0;
+    TREE_STAT(++counters.rebalances;)
+    root = linkBalanced(kept, 0, static_cast<int>(kept.size()) - 1);
+    return removed;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::join(BinaryTree<T, K, Compare, Augment>& greater) {
+    // Moves every node of `greater`, whose keys must all be above the keys here, into this
+    // tree and leaves `greater` empty.
+    if (this == &greater || !greater.root) return;
+    if (root && !keyLess(getMaxNode(root)->key, getMinNode(greater.root)->key)) {
+        throw Errors::InvalidArgument("Keys of the joined trees overlap.");
+    }
+    finishCheckpoint();
+    greater.finishCheckpoint();
+    resetIndex();
+    greater.resetIndex();
+    clearHot();
+    greater.clearHot();
+    // Hashed nodes bring their hashes along; otherwise this side rehashes afterwards.
+    bool rehash = hashing && !greater.hashing;
+    if (rehash) {
+        hashing = false;
+        dropHashes();
+    }
+
+    Node* mid;
+    Node* rest = greater.detachMin(greater.root, mid);
+    if (hashing && greater.hashing) hashes.merge(greater.hashes);
+    greater.dropHashes();
+    root = joinWith(root, mid, rest);
+    size += greater.size;
+    tombstones += greater.tombstones;
+    greater.root = nullptr;
+    greater.size = 0;
+    greater.tombstones = 0;
+
+    greater.rebuildValueIndex();
+    rebuildValueIndex();
+    if (filterBitsPerKey) rebuildFilter();
+    if (greater.filterBitsPerKey) greater.rebuildFilter();
+    if (rehash) enableHashing();
+    if (greater.hashing) greater.ensureHashes();
+    if (heightLimit > 0 && GetDepth() > heightLimit) balance();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::equals(Node* a, Node* b) const {
     if (!a && !b) return true;
     if (!a || !b) return false;
-    return a->value == b->value && equals(a->left, b->left) && equals(a->right, b->right);
+    if (a->dead != b->dead) return false;
+    return (a->dead || a->value == b->value) && equals(a->left, b->left) && equals(a->right, b->right);
 }
 
-template<typename T>
-bool BinaryTree<T>::containsSubtree(Node* root, Node* sub) const {
-    if (!root) return false;
-    if (equals(root, sub)) return true;
-    return containsSubtree(root->left, sub) || containsSubtree(root->right, sub);
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::containsSubtree(const BinaryTree<T, K, Compare, Augment>& sub) const {
+    if (!root || !sub.root) return false;
+    ensureHashes();
+    sub.ensureHashes();
+
+    if (!hashIndexed) {
+        std::vector<Node*> stack{ root };
+        while (!stack.empty()) {
+            Node* node = stack.back();
+            stack.pop_back();
+            hashIndex.emplace(hashOf(node), node);
+            if (node->left) stack.push_back(node->left);
+            if (node->right) stack.push_back(node->right);
+        }
+        hashIndexed = true;
+    }
+
+    auto range = hashIndex.equal_range(sub.hashOf(sub.root));
+    for (auto it = range.first; it != range.second; ++it) {
+        if (equals(it->second, sub.root)) return true;
+    }
+    return false;
 }
 
-template<typename T>
-bool BinaryTree<T>::containsSubtree(const BinaryTree<T>& sub) const {
-    return containsSubtree(root, sub.root);
+template<typename T, typename K, typename Compare, typename Augment>
+size_t BinaryTree<T, K, Compare, Augment>::digest() const {
+    ensureHashes();
+    return digestOf(root);
 }
 
-template<typename T>
-bool BinaryTree<T>::containsNode(const T& value) const {
-    return find(root, value) != nullptr;
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Aggregate BinaryTree<T, K, Compare, Augment>::aggregate() const {
+    static_assert(augmented, "aggregate() needs an Augment template argument");
+    return aggregateOf(root);
 }
 
-template<typename T>
-typename BinaryTree<T>::Node* BinaryTree<T>::find(Node* node, const T& value) const {
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Aggregate BinaryTree<T, K, Compare, Augment>::aggregate(const K& lo, const K& hi) const {
+    static_assert(augmented, "aggregate() needs an Augment template argument");
+    // Descend to the first node inside [lo, hi]; below it the range is a suffix of its left
+    // subtree and a prefix of its right one. Each boundary walk adds whole subtrees hanging
+    // on the inner side of the path, so only O(height) nodes are visited.
+    Node* split = root;
+    while (split) {
+        TREE_STAT(++counters.nodesVisited;)
+        if (keyLess(split->key, lo)) split = split->right;
+        else if (keyLess(hi, split->key)) split = split->left;
+        else break;
+    }
+    if (!split) return Augment::identity();
+
+    Aggregate left = Augment::identity();
+    for (Node* node = split->left; node;) {
+        TREE_STAT(++counters.nodesVisited;)
+        if (keyLess(node->key, lo)) node = node->right;
+        else {
+            left = Augment::combine(liftOf(node), Augment::combine(aggregateOf(node->right), left));
+            node = node->left;
+        }
+    }
+
+    Aggregate right = Augment::identity();
+    for (Node* node = split->right; node;) {
+        TREE_STAT(++counters.nodesVisited;)
+        if (keyLess(hi, node->key)) node = node->left;
+        else {
+            right = Augment::combine(right, Augment::combine(aggregateOf(node->left), liftOf(node)));
+            node = node->right;
+        }
+    }
+
+    return Augment::combine(left, Augment::combine(liftOf(split), right));
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Diff BinaryTree<T, K, Compare, Augment>::diff(const BinaryTree<T, K, Compare, Augment>& target) const {
+    Diff result;
+    ensureHashes();
+    target.ensureHashes();
+    diffNodes(root, target, target.root, result);
+    return result;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::diffNodes(Node* a, const BinaryTree& target, Node* b, Diff& out) const {
+    if (digestOf(a) == target.digestOf(b)) return;
+
+    if (a && b && keyEqual(a->key, b->key)) {
+        if (a->dead != b->dead) {
+            if (a->dead) out.inserted.push_back({ b->key, b->value });
+            else out.removed.push_back(a->key);
+        }
+        else if (!a->dead && !(a->value == b->value)) out.changed.push_back({ b->key, b->value });
+        diffNodes(a->left, target, b->left, out);
+        diffNodes(a->right, target, b->right, out);
+        return;
+    }
+
+    // Shapes no longer line up: merge the in-order sequences of both subtrees.
+    std::vector<std::pair<K, T>> from, to;
+    inOrderCollect(a, from);
+    inOrderCollect(b, to);
+
+    size_t i = 0, j = 0;
+    while (i < from.size() || j < to.size()) {
+        if (j == to.size() || (i < from.size() && keyLess(from[i].first, to[j].first))) {
+            out.removed.push_back(from[i++].first);
+        }
+        else if (i == from.size() || keyLess(to[j].first, from[i].first)) {
+            out.inserted.push_back(to[j++]);
+        }
+        else {
+            if (!(from[i].second == to[j].second)) out.changed.push_back(to[j]);
+            ++i;
+            ++j;
+        }
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::patch(const Diff& d) {
+    for (const K& key : d.removed) remove(key);
+    for (const auto& [key, value] : d.changed) insert(key, value);
+    for (const auto& [key, value] : d.inserted) insert(key, value);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::Diff::toBinary(std::string& out) const {
+    Codecs::WriteVarint(out, inserted.size());
+    for (const auto& [key, value] : inserted) {
+        Codec<K>::writeBinary(out, key);
+        Codec<T>::writeBinary(out, value);
+    }
+    Codecs::WriteVarint(out, removed.size());
+    for (const K& key : removed) Codec<K>::writeBinary(out, key);
+    Codecs::WriteVarint(out, changed.size());
+    for (const auto& [key, value] : changed) {
+        Codec<K>::writeBinary(out, key);
+        Codec<T>::writeBinary(out, value);
+    }
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Diff BinaryTree<T, K, Compare, Augment>::Diff::fromBinary(const std::string& bytes, size_t& pos) {
+    Diff d;
+    for (uint64_t n = Codecs::ReadVarint(bytes, pos); n > 0; --n) {
+        K key = Codec<K>::readBinary(bytes, pos);
+        d.inserted.push_back({ key, Codec<T>::readBinary(bytes, pos) });
+    }
+    for (uint64_t n = Codecs::ReadVarint(bytes, pos); n > 0; --n) {
+        d.removed.push_back(Codec<K>::readBinary(bytes, pos));
+    }
+    for (uint64_t n = Codecs::ReadVarint(bytes, pos); n > 0; --n) {
+        K key = Codec<K>::readBinary(bytes, pos);
+        d.changed.push_back({ key, Codec<T>::readBinary(bytes, pos) });
+    }
+    return d;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::containsNode(const T& value) const {
+    return findValue(value) != nullptr;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::find(Node* node, const T& value) const {
     if (!node) return nullptr;
-    if (node->value == value) return node;
+    if (!node->dead && node->value == value) return node;
     Node* l = find(node->left, value);
     if (l) return l;
     return find(node->right, value);
 }
 
 
-template<typename T>
-std::string BinaryTree<T>::toString() const {
-    return serializeNode(root);
+template<typename T, typename K, typename Compare, typename Augment>
+std::string BinaryTree<T, K, Compare, Augment>::toString() const {
+    std::string out;
+    serializeNode(root, out);
+    TREE_STAT(counters.bytesSerialized += out.size();)
+    return out;
 }
 
-template<typename T>
-std::string BinaryTree<T>::serializeNode(Node* node) const {
-    if (!node) return "()"; 
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::serializeNode(Node* node, std::string& out) const {
+    if (!node) { out += "()"; return; }
 
-    std::ostringstream out;
-    out << "("; 
-    out << serializeNode(node->left); 
+    out += "(";
+    serializeNode(node->left, out);
 
-    out << node->key << ":";
-    if constexpr (std::is_same_v<T, std::function<double(double)>>) {
-        out << "<function>";
+    Codec<K>::writeText(out, node->key);
+    out += ":";
+    // A tombstone has a second colon in place of its value; no value text starts with one.
+    if (node->dead) out += ":";
+    else if constexpr (std::is_same_v<T, std::function<double(double)>>) {
+        out += "<function>";
     }
     else {
-        out << node->value;
+        Codec<T>::writeText(out, node->value);
     }
 
-    out << serializeNode(node->right);
-    out << ")";
-
-    return out.str();
+    serializeNode(node->right, out);
+    out += ")";
 }
 
-template<typename T>
-bool BinaryTree<T>::isValidTreeString(const std::string& s) {
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::isValidTreeString(const std::string& s) {
     size_t pos = 0;
     try {
         Node* node = parseNode(s, pos);
         if (pos != s.size()) throw Errors::ParseError();
 
         bool valid = isValidBST(node, nullptr, nullptr);
+        TREE_STAT(int parsed = countNodes(node); counters.allocations += parsed; counters.frees += parsed;)
         destroy(node);
 
         return valid;
@@ -385,11 +1626,11 @@ bool BinaryTree<T>::isValidTreeString(const std::string& s) {
     }
 }
 
-template<typename T>
-bool BinaryTree<T>::isValidBST(Node* node, const int* minKey, const int* maxKey) const {
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::isValidBST(Node* node, const K* minKey, const K* maxKey) const {
     if (!node) return true;
 
-    if ((minKey && node->key <= *minKey) || (maxKey && node->key >= *maxKey))
+    if ((minKey && !keyLess(*minKey, node->key)) || (maxKey && !keyLess(node->key, *maxKey)))
         return false;
 
     return isValidBST(node->left, minKey, &node->key) && isValidBST(node->right, &node->key, maxKey);
@@ -397,22 +1638,164 @@ bool BinaryTree<T>::isValidBST(Node* node, const int* minKey, const int* maxKey)
 
 
 
-template<typename T>
-BinaryTree<T> BinaryTree<T>::fromString(const std::string& str) {
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment> BinaryTree<T, K, Compare, Augment>::fromString(const std::string& str) {
     size_t pos = 0;
-    BinaryTree<T> tree;
+    BinaryTree<T, K, Compare, Augment> tree;
 
     if (!tree.isValidTreeString(str)) {
         throw Errors::ParseError("Invalid tree string: structure or BST property violated.");
     }
 
     tree.root = tree.parseNode(str, pos);
+    tree.tombstones = countDead(tree.root);
+    tree.size = countNodes(tree.root) - tree.tombstones;
+    TREE_STAT(tree.counters.allocations += tree.size + tree.tombstones; tree.counters.bytesParsed += str.size();)
     return tree;
 }
 
 
-template<typename T>
-typename BinaryTree<T>::Node* BinaryTree<T>::parseNode(const std::string& s, size_t& pos) {
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::toBinary(std::ostream& os) const {
+    [[maybe_unused]] size_t written = writeBinary(root, os);
+    TREE_STAT(counters.bytesSerialized += written;)
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+size_t BinaryTree<T, K, Compare, Augment>::writeBinary(Node* node, std::ostream& os) {
+    // Preorder, one flags byte per node (bit 0 - has left, bit 1 - has right, bit 2 - tombstone),
+    // then key and, unless it is a tombstone, value.
+    std::string buf;
+    size_t written = 0;
+    buf += static_cast<char>(node ? 1 : 0);
+
+    std::vector<Node*> stack;
+    if (node) stack.push_back(node);
+    while (!stack.empty()) {
+        Node* cur = stack.back();
+        stack.pop_back();
+
+        buf += static_cast<char>((cur->left ? 1 : 0) | (cur->right ? 2 : 0) | (cur->dead ? 4 : 0));
+        Codec<K>::writeBinary(buf, cur->key);
+        if (!cur->dead) Codec<T>::writeBinary(buf, cur->value);
+
+        if (cur->right) stack.push_back(cur->right);
+        if (cur->left) stack.push_back(cur->left);
+
+        if (buf.size() >= (1 << 20)) {
+            os.write(buf.data(), buf.size());
+            written += buf.size();
+            buf.clear();
+        }
+    }
+    os.write(buf.data(), buf.size());
+    return written + buf.size();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment> BinaryTree<T, K, Compare, Augment>::fromSorted(const std::vector<K>& keys, const std::vector<T>& values, unsigned threads) {
+    if (keys.size() != values.size()) throw Errors::InvalidArgument("Keys and values have different lengths.");
+    for (size_t i = 1; i < keys.size(); ++i) {
+        if (!keyLess(keys[i - 1], keys[i])) throw Errors::InvalidArgument("Keys are not strictly increasing.");
+    }
+
+    BinaryTree<T, K, Compare, Augment> tree;
+    tree.root = buildSorted(keys, values, 0, keys.size(), std::max(1u, threads));
+    tree.size = static_cast<int>(keys.size());
+    TREE_STAT(tree.counters.allocations += tree.size;)
+    return tree;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::buildSorted(const std::vector<K>& keys, const std::vector<T>& values, size_t lo, size_t hi, unsigned threads) {
+    if (lo >= hi) return nullptr;
+    size_t mid = lo + (hi - lo) / 2;
+    Node* node = new Node(keys[mid], values[mid]);
+
+    if (threads > 1 && hi - lo > (1 << 16)) {
+        // The left half goes to a new thread, the right half stays on this one.
+        std::exception_ptr leftError;
+        std::thread worker([&]() {
+            try { node->left = buildSorted(keys, values, lo, mid, threads / 2); }
+            catch (...) { leftError = std::current_exception(); }
+        });
+        try {
+            node->right = buildSorted(keys, values, mid + 1, hi, threads - threads / 2);
+        }
+        catch (...) {
+            worker.join();
+            destroy(node);
+            throw;
+        }
+        worker.join();
+        if (leftError) {
+            destroy(node);
+            std::rethrow_exception(leftError);
+        }
+    }
+    else {
+        try {
+            node->left = buildSorted(keys, values, lo, mid, 1);
+            node->right = buildSorted(keys, values, mid + 1, hi, 1);
+        }
+        catch (...) {
+            destroy(node);
+            throw;
+        }
+    }
+
+    refresh(node);
+    return node;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment> BinaryTree<T, K, Compare, Augment>::fromBinary(const std::string& bytes) {
+    BinaryTree<T, K, Compare, Augment> tree;
+    size_t pos = 0;
+
+    // The bytes may come from a damaged or edited file, so every key is checked against the
+    // range its position allows: a tree out of order would make search() and remove() miss keys.
+    struct Slot {
+        Node** link;
+        const K* lo;
+        const K* hi;
+    };
+    std::vector<Slot> slots;
+    if (Codecs::ReadU64(bytes, pos, 1)) slots.push_back({ &tree.root, nullptr, nullptr });
+    while (!slots.empty()) {
+        Slot slot = slots.back();
+        slots.pop_back();
+
+        int flags = static_cast<int>(Codecs::ReadU64(bytes, pos, 1));
+        if (flags & ~7) throw Errors::DeserializeFailed();
+        K key = Codec<K>::readBinary(bytes, pos);
+        if ((slot.lo && !tree.keyLess(*slot.lo, key)) || (slot.hi && !tree.keyLess(key, *slot.hi))) {
+            throw Errors::DeserializeFailed();
+        }
+        Node* node;
+        if (flags & 4) {
+            node = *slot.link = new Node(key, T{});
+            node->dead = true;
+            ++tree.tombstones;
+        }
+        else {
+            node = *slot.link = new Node(key, Codec<T>::readBinary(bytes, pos));
+            ++tree.size;
+        }
+
+        if (flags & 2) slots.push_back({ &node->right, &node->key, slot.hi });
+        if (flags & 1) slots.push_back({ &node->left, slot.lo, &node->key });
+    }
+
+    if (pos != bytes.size()) throw Errors::DeserializeFailed();
+    refreshAll(tree.root);
+    TREE_STAT(tree.counters.allocations += tree.size + tree.tombstones; tree.counters.bytesParsed += bytes.size();)
+    return tree;
+}
+
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::parseNode(const std::string& s, size_t& pos) {
     if (pos >= s.size() || s[pos] != '(') throw Errors::ParseError();
     ++pos;
 
@@ -420,19 +1803,13 @@ typename BinaryTree<T>::Node* BinaryTree<T>::parseNode(const std::string& s, siz
 
     Node* left = parseNode(s, pos);
 
-    std::string key_str;
-    while (pos < s.size() && std::isdigit(s[pos]))
-        key_str += s[pos++];
-    if (key_str.empty() || s[pos++] != ':')
+    K key = Codec<K>::readText(s, pos);
+    if (pos >= s.size() || s[pos++] != ':')
         throw Errors::ParseError();
-    int key = std::stoi(key_str);
 
-    std::string val_str;
-    while (pos < s.size() && s[pos] != '(' && s[pos] != ')')
-        val_str += s[pos++];
-    std::istringstream vs(val_str);
-    T value;
-    vs >> value;
+    bool dead = pos < s.size() && s[pos] == ':';
+    if (dead) ++pos;
+    T value = dead ? T{} : Codec<T>::readText(s, pos);
 
     Node* right = parseNode(s, pos);
 
@@ -440,15 +1817,17 @@ typename BinaryTree<T>::Node* BinaryTree<T>::parseNode(const std::string& s, siz
     ++pos;
 
     Node* node = new Node(key, value);
+    node->dead = dead;
     node->left = left;
     node->right = right;
+    refresh(node);
     return node;
 }
 
 
 
-template<typename T>
-T* BinaryTree<T>::findByPath(const std::string& path) const {
+template<typename T, typename K, typename Compare, typename Augment>
+T* BinaryTree<T, K, Compare, Augment>::findByPath(const std::string& path) const {
     Node* node = root;
     for (char c : path) {
         if (!node) return nullptr;
@@ -456,12 +1835,12 @@ T* BinaryTree<T>::findByPath(const std::string& path) const {
         else if (c == 'P') node = node->right;
         else throw Errors::InvalidPath();
     }
-    return node ? &node->value : nullptr;
+    return node && !node->dead ? &node->value : nullptr;
 }
 
-template<typename T>
-T* BinaryTree<T>::findByRelativePath(const std::string& path, const T& from) const {
-    Node* node = find(root, from);
+template<typename T, typename K, typename Compare, typename Augment>
+T* BinaryTree<T, K, Compare, Augment>::findByRelativePath(const std::string& path, const T& from) const {
+    Node* node = findValue(from);
     if (!node) return nullptr;
     for (char c : path) {
         if (!node) return nullptr;
@@ -469,53 +1848,217 @@ T* BinaryTree<T>::findByRelativePath(const std::string& path, const T& from) con
         else if (c == 'P') node = node->right;
         else throw Errors::InvalidPath();
     }
-    return node ? &node->value : nullptr;
+    return node && !node->dead ? &node->value : nullptr;
 }
 
-template<typename T>
-typename BinaryTree<T>::Node* BinaryTree<T>::buildBalancedTree(const std::vector<std::pair<int, T>>& nodes, int start, int end) {
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::linkBalanced(std::vector<Node*>& nodes, int start, int end) {
     if (start > end) return nullptr;
-    int mid = (start + end) / 2;
-    Node* node = new Node(nodes[mid].first, nodes[mid].second);
-    node->left = buildBalancedTree(nodes, start, mid - 1);
-    node->right = buildBalancedTree(nodes, mid + 1, end);
+    int mid = start + (end - start) / 2;
+    Node* node = nodes[mid];
+    node->left = linkBalanced(nodes, start, mid - 1);
+    node->right = linkBalanced(nodes, mid + 1, end);
+    update(node);
     return node;
 }
 
-template<typename T>
-void BinaryTree<T>::inOrderCollect(Node* node, std::vector<std::pair<int, T>>& out) const {
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::rebuild(Node* node) {
+    // Relinks the existing nodes of the subtree into a balanced shape; values are never copied.
+    // Tombstones are freed on the way.
+    std::vector<Node*> nodes;
+    std::vector<Node*> stack;
+    while (node || !stack.empty()) {
+        while (node) {
+            stack.push_back(node);
+            node = node->left;
+        }
+        node = stack.back();
+        stack.pop_back();
+        Node* next = node->right;
+        if (node->dead) {
+            release(node);
+            --tombstones;
+        }
+        else nodes.push_back(writable(node));
+        node = next;
+    }
+    TREE_STAT(++counters.rebalances; counters.nodesVisited += nodes.size();)
+    return linkBalanced(nodes, 0, static_cast<int>(nodes.size()) - 1);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+int BinaryTree<T, K, Compare, Augment>::countNodes(Node* node, int limit) {
+    int count = 0;
+    std::vector<Node*> stack;
+    if (node) stack.push_back(node);
+    while (!stack.empty() && count < limit) {
+        Node* cur = stack.back();
+        stack.pop_back();
+        ++count;
+        if (cur->left) stack.push_back(cur->left);
+        if (cur->right) stack.push_back(cur->right);
+    }
+    return count;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+int BinaryTree<T, K, Compare, Augment>::countDead(Node* node) {
+    int count = 0;
+    std::vector<Node*> stack;
+    if (node) stack.push_back(node);
+    while (!stack.empty()) {
+        Node* cur = stack.back();
+        stack.pop_back();
+        count += cur->dead;
+        if (cur->left) stack.push_back(cur->left);
+        if (cur->right) stack.push_back(cur->right);
+    }
+    return count;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::firstLive(bool fromMax) const {
+    // In-order walk from the smallest (or largest) key to the first node that is not a tombstone.
+    std::vector<Node*> stack;
+    Node* node = root;
+    while (node || !stack.empty()) {
+        while (node) {
+            stack.push_back(node);
+            node = fromMax ? node->right : node->left;
+        }
+        node = stack.back();
+        stack.pop_back();
+        if (!node->dead) return node;
+        node = fromMax ? node->left : node->right;
+    }
+    return nullptr;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::rebuildPath(const K& key) {
+    // With more keys than 2^bound - 1 no shape fits, and rebuilding from the root on every
+    // insert would only make them quadratic.
+    double rootCapacity = std::ldexp(1.0, std::min(heightLimit, 62)) - 1;
+    if (size > rootCapacity) return;
+
+    std::vector<Node*> path;
+    for (Node* node = root; node; node = keyLess(key, node->key) ? node->left : node->right) {
+        path.push_back(node);
+        if (keyEqual(node->key, key)) break;
+    }
+
+    // Walk up from the inserted node and rebuild the lowest ancestor that is sparse enough for
+    // its depth. At depth i a subtree may fill at most a fraction d(i) of the 2^(bound - i) - 1
+    // slots below it, with d growing from the root's current density (at least 1/2) to 1 at the
+    // bottom (Andersson's density rule). A rebuild then leaves room proportional to its size,
+    // which keeps inserts amortized O(log^2 n) under the bound.
+    double rootDensity = std::max(0.5, size / rootCapacity);
+    int i = static_cast<int>(path.size()) - 1;
+    int fits = -1;
+    double subtreeSize = 1;
+    for (;; --i) {
+        int budget = heightLimit - i;
+        if (budget > 0) {
+            double capacity = std::ldexp(1.0, std::min(budget, 62)) - 1;
+            double density = rootDensity + (1 - rootDensity) * i / heightLimit;
+            if (subtreeSize <= capacity) {
+                if (fits < 0) fits = i;
+                if (subtreeSize <= density * capacity) break;
+            }
+        }
+        if (i == 0) {
+            // Nothing fits only when tombstones overflow the root; rebuilding frees them.
+            i = fits >= 0 ? fits : 0;
+            break;
+        }
+
+        Node* parent = path[i - 1];
+        subtreeSize += 1 + countNodes(parent->left == path[i] ? parent->right : parent->left);
+    }
+
+    resetIndex();
+    Node* rebuilt = rebuild(path[i]);
+    if (i == 0) {
+        root = rebuilt;
+        return;
+    }
+
+    Node* parent = path[i - 1];
+    if (parent->left == path[i]) parent->left = rebuilt;
+    else parent->right = rebuilt;
+    for (int j = i - 1; j >= 0; --j) update(path[j]);
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::inOrderCollect(Node* node, std::vector<std::pair<K, T>>& out) const {
     if (!node) return;
     inOrderCollect(node->left, out);
-    out.push_back({ node->key, node->value });
+    if (!node->dead) out.push_back({ node->key, node->value });
     inOrderCollect(node->right, out);
 }
 
-template<typename T>
-void BinaryTree<T>::balance() {
-    std::vector<std::pair<int, T>> nodes;
-    inOrderCollect(root, nodes);
-    destroy(root);
-    root = buildBalancedTree(nodes, 0, nodes.size() - 1);
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::balance() {
+    resetIndex();
+    root = rebuild(root);
+    if (filterBitsPerKey) rebuildFilter();
 }
 
-template<typename T>
-int BinaryTree<T>::getDepth(Node* node) const {
-    if (!node) return 0;
-    return 1 + std::max(getDepth(node->left), getDepth(node->right));
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::setHeightBound(int bound) {
+    if (bound > 0 && size > std::ldexp(1.0, std::min(bound, 62)) - 1) {
+        throw Errors::InvalidArgument("Height bound " + std::to_string(bound) + " is too small for " + std::to_string(size) + " keys.");
+    }
+    heightLimit = bound;
+    if (heightLimit > 0 && GetDepth() > heightLimit) balance();
 }
 
-template<typename T>
-int BinaryTree<T>::GetDepth() const {
+template<typename T, typename K, typename Compare, typename Augment>
+int BinaryTree<T, K, Compare, Augment>::heightBound() const {
+    return heightLimit;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::setTombstoneRatio(double ratio) {
+    if (!(ratio >= 0 && ratio < 1)) throw Errors::InvalidArgument("Tombstone ratio must be in [0, 1).");
+    tombstoneLimit = ratio;
+    if (tombstones > tombstoneLimit * (size + tombstones)) compact();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+double BinaryTree<T, K, Compare, Augment>::tombstoneRatio() const {
+    return tombstoneLimit;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+int BinaryTree<T, K, Compare, Augment>::tombstoneCount() const {
+    return tombstones;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::compact() {
+    if (!tombstones) return;
+    balance();
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+int BinaryTree<T, K, Compare, Augment>::getDepth(Node* node) {
+    return node ? node->height : 0;
+}
+
+template<typename T, typename K, typename Compare, typename Augment>
+int BinaryTree<T, K, Compare, Augment>::GetDepth() const {
     return getDepth(root);
 }
 
-template<typename T>
-void BinaryTree<T>::PrintTree() const {
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::PrintTree() const {
     printNode(root, 0);
 }
 
-template<typename T>
-void BinaryTree<T>::printNode(Node* node, int indent) const {
+template<typename T, typename K, typename Compare, typename Augment>
+void BinaryTree<T, K, Compare, Augment>::printNode(Node* node, int indent) const {
     if (node) {
         if (node->right) printNode(node->right, indent + 5);
 
@@ -523,7 +2066,8 @@ void BinaryTree<T>::printNode(Node* node, int indent) const {
 
         //std::cout << node->key << ": ";
 
-        if constexpr (std::is_same_v<T, std::function<double(double)>>) {
+        if (node->dead) std::cout << "<removed>" << std::endl;
+        else if constexpr (std::is_same_v<T, std::function<double(double)>>) {
             std::cout << "<function>" << std::endl;
         }
         else {
@@ -535,22 +2079,37 @@ void BinaryTree<T>::printNode(Node* node, int indent) const {
 }
 
 
-template<typename T>
-bool BinaryTree<T>::operator==(const BinaryTree<T>& other) const {
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::operator==(const BinaryTree<T, K, Compare, Augment>& other) const {
     return equals(this->root, other.root);
 }
 
-template<typename T>
-bool BinaryTree<T>::operator!=(const BinaryTree<T>& other) const {
+template<typename T, typename K, typename Compare, typename Augment>
+bool BinaryTree<T, K, Compare, Augment>::operator!=(const BinaryTree<T, K, Compare, Augment>& other) const {
     return !(*this == other);
 }
 
-template<typename T>
-BinaryTree<T>& BinaryTree<T>::operator=(const BinaryTree<T>& other) {
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment>& BinaryTree<T, K, Compare, Augment>::operator=(const BinaryTree<T, K, Compare, Augment>& other) {
     if (this != &other) {
+        finishCheckpoint();
+        dropHashes();
+        TREE_STAT(counters.frees += size + tombstones;)
         destroy(root);
         root = copy(other.root);
+        hashing = other.hashing;
+        if (hashing) ensureHashes();
         size = other.size;
+        heightLimit = other.heightLimit;
+        tombstones = other.tombstones;
+        tombstoneLimit = other.tombstoneLimit;
+        valueIndexed = other.valueIndexed;
+        rebuildValueIndex();
+        hotSlots.assign(other.hotSlots.size(), HotSlot());
+        filter = other.filter;
+        filterKeys = other.filterKeys;
+        filterCapacity = other.filterCapacity;
+        filterBitsPerKey = other.filterBitsPerKey;
     }
     return *this;
 }
@@ -572,86 +2131,160 @@ std::vector<T> translate(const std::string& str) {
     return res;
 }
 
-template<typename T>
-std::vector<T> subvector(const std::vector<T>& vec, size_t start, size_t end) {
-    if (start >= vec.size() || end >= vec.size() || start > end) {
-        return {};
+template<typename T, typename K, typename Compare, typename Augment>
+typename BinaryTree<T, K, Compare, Augment>::Node* BinaryTree<T, K, Compare, Augment>::recovery(std::vector<T>& KLP, std::vector<T>& LKP) {
+    if (KLP.empty() || LKP.empty()) {
+        return nullptr;
     }
-
-    std::vector<T> res;
-
-    for (size_t i = start; i <= end; ++i) {
-        res.push_back(vec[i]);
+    if (KLP.size() != LKP.size()) {
+        throw Errors::InvalidArgument("Traversals have different lengths.");
     }
-    return res;
-}
 
-template<typename T>
-size_t index(std::vector<T> vec, T value) {
+    std::unordered_map<T, size_t> position;
+    position.reserve(LKP.size());
+    for (size_t i = 0; i < LKP.size(); ++i) {
+        if (!position.emplace(LKP[i], i).second) throw Errors::InvalidArgument("Duplicate values in traversal.");
+    }
 
-    auto it = std::find(vec.begin(), vec.end(), value);
+    // Subtree rooted at KLP[pre] whose in-order traversal is LKP[lo, hi).
+    struct Range {
+        size_t pre, lo, hi;
+        Node** slot;
+    };
 
-    if (it == vec.end()) throw Errors::IndexOutOfRange();
+    Node* root = nullptr;
+    std::vector<Range> stack{ { 0, 0, LKP.size(), &root } };
+    try {
+        while (!stack.empty()) {
+            Range r = stack.back();
+            stack.pop_back();
+            if (r.lo == r.hi) continue;
+
+            auto it = position.find(KLP[r.pre]);
+            if (it == position.end() || it->second < r.lo || it->second >= r.hi) {
+                throw Errors::InvalidArgument("Traversals of difirent trees.");
+            }
+            size_t mid = it->second;
+
+            Node* node = new Node(static_cast<K>(KLP[r.pre]), KLP[r.pre]);
+            *r.slot = node;
+            stack.push_back({ r.pre + 1 + (mid - r.lo), mid + 1, r.hi, &node->right });
+            stack.push_back({ r.pre + 1, r.lo, mid, &node->left });
+        }
+    }
+    catch (...) {
+        destroy(root);
+        throw;
+    }
 
-    return std::distance(vec.begin(), it);
+    refreshAll(root);
+    return root;
 }
 
-template<typename T>
-typename BinaryTree<T>::Node* BinaryTree<T>::recovery(std::vector<T>& KLP, std::vector<T>& LKP) {
-
-    if (KLP.empty() || LKP.empty()) {
-        return nullptr;
-    }
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment> BinaryTree<T, K, Compare, Augment>::recoveryTree(const std::string& KLP_str, const std::string& LKP_str) {
 
-    T root_value = KLP[0];
+    std::vector<T> KLP = translate<T>(KLP_str);
+    std::vector<T> LKP = translate<T>(LKP_str);
 
-    size_t root_idx = index(LKP, root_value);
+    if (KLP.size() != LKP.size()) {
+        throw Errors::InvalidArgument("Traversals have different lengths.");
+    }
 
-    std::vector<T> left_LKP = subvector(LKP, 0, root_idx - 1);
-    std::vector<T> right_LKP = subvector(LKP, root_idx + 1, LKP.size() - 1);
+    for (size_t i = 1; i < LKP.size(); ++i) {
+        if (!keyLess(static_cast<K>(LKP[i - 1]), static_cast<K>(LKP[i]))) {
+            throw Errors::InvalidArgument("Invalid traversals.");
+        }
+    }
 
-    std::vector<T> left_KLP = subvector(KLP, 1, root_idx);
-    std::vector<T> right_KLP = subvector(KLP, root_idx + 1, KLP.size() - 1);
+    BinaryTree<T, K, Compare, Augment> res;
+    res.root = recovery(KLP, LKP);
+    res.size = static_cast<int>(LKP.size());
+    TREE_STAT(res.counters.allocations += res.size; res.counters.bytesParsed += KLP_str.size() + LKP_str.size();)
 
-    typename BinaryTree<T>::Node* node = new typename BinaryTree<T>::Node(static_cast<int>(root_value), root_value);
+    return res;
+}
 
-    node->left = recovery(left_KLP, left_LKP);
-    node->right = recovery(right_KLP, right_LKP);
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment> BinaryTree<T, K, Compare, Augment>::recoveryFromKLP(const std::string& KLP_str) {
+    std::vector<T> KLP = translate<T>(KLP_str);
 
-    return node;
-}
+    BinaryTree<T, K, Compare, Augment> res;
+    if (KLP.empty()) return res;
 
-template<typename T>
-BinaryTree<T> BinaryTree<T>::recoveryTree(const std::string& KLP_str, const std::string& LKP_str) {
+    res.root = new Node(static_cast<K>(KLP[0]), KLP[0]);
+    res.size = 1;
 
-    std::vector<T> KLP = translate<T>(KLP_str);
-    std::vector<T> LKP = translate<T>(LKP_str);
+    std::vector<Node*> stack{ res.root };
+    bool hasLow = false;
+    K low{};
+    for (size_t i = 1; i < KLP.size(); ++i) {
+        K key = static_cast<K>(KLP[i]);
+        if (hasLow && !keyLess(low, key)) throw Errors::InvalidArgument("Not a preorder traversal of a BST.");
 
-    if (KLP.size() != LKP.size()) {
-        throw Errors::InvalidArgument("Traversals have different lengths.");
+        Node* parent = nullptr;
+        while (!stack.empty() && keyLess(stack.back()->key, key)) {
+            parent = stack.back();
+            stack.pop_back();
+        }
+        if (!stack.empty() && keyEqual(stack.back()->key, key)) throw Errors::InvalidArgument("Duplicate values in traversal.");
+
+        Node* node = new Node(key, KLP[i]);
+        ++res.size;
+        if (parent) {
+            parent->right = node;
+            hasLow = true;
+            low = parent->key;
+        }
+        else {
+            stack.back()->left = node;
+        }
+        stack.push_back(node);
     }
 
-    std::vector<T> sortedKLP = KLP;
-    std::vector<T> sortedLKP = LKP;
+    refreshAll(res.root);
+    TREE_STAT(res.counters.allocations += res.size; res.counters.bytesParsed += KLP_str.size();)
+    return res;
+}
 
-    std::sort(sortedKLP.begin(), sortedKLP.end());
-    std::sort(sortedLKP.begin(), sortedLKP.end());
+template<typename T, typename K, typename Compare, typename Augment>
+BinaryTree<T, K, Compare, Augment> BinaryTree<T, K, Compare, Augment>::recoveryFromLPK(const std::string& LPK_str) {
+    std::vector<T> LPK = translate<T>(LPK_str);
 
-    if (sortedKLP != sortedLKP) {
-        throw Errors::InvalidArgument("Traversals of difirent trees.");
-    }
+    BinaryTree<T, K, Compare, Augment> res;
+    if (LPK.empty()) return res;
 
-    /*if (LKP[0] > KLP[0] || KLP[0] > LKP[index(LKP, KLP[0]) + 1]) {
-        throw Errors::InvalidArgument("Tree is not exist.");
-    }*/
+    res.root = new Node(static_cast<K>(LPK.back()), LPK.back());
+    res.size = 1;
 
-    BinaryTree<T> res;
-    res.root = recovery(KLP, LKP);
+    std::vector<Node*> stack{ res.root };
+    bool hasHigh = false;
+    K high{};
+    for (size_t i = LPK.size() - 1; i-- > 0;) {
+        K key = static_cast<K>(LPK[i]);
+        if (hasHigh && !keyLess(key, high)) throw Errors::InvalidArgument("Not a postorder traversal of a BST.");
 
-    if (!res.isValidBST(res.root, nullptr, nullptr)) {
-        throw Errors::InvalidArgument("Invalid traversals.");
+        Node* parent = nullptr;
+        while (!stack.empty() && keyLess(key, stack.back()->key)) {
+            parent = stack.back();
+            stack.pop_back();
+        }
+        if (!stack.empty() && keyEqual(stack.back()->key, key)) throw Errors::InvalidArgument("Duplicate values in traversal.");
+
+        Node* node = new Node(key, LPK[i]);
+        ++res.size;
+        if (parent) {
+            parent->left = node;
+            hasHigh = true;
+            high = parent->key;
+        }
+        else {
+            stack.back()->right = node;
+        }
+        stack.push_back(node);
     }
 
+    refreshAll(res.root);
+    TREE_STAT(res.counters.allocations += res.size; res.counters.bytesParsed += LPK_str.size();)
     return res;
 }
-
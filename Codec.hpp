@@ -0,0 +1,249 @@
+#pragma once
+
+#include <string>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <type_traits>
+#include <functional>
+#include <string_view>
+#include "error.hpp"
+
+// Codec<T> is the value encoding used by the tree serializers.
+//
+// Every specialization provides:
+//   static constexpr const char* tag;                                 - stable type name
+//   static void writeBinary(std::string& out, const T& value);        - compact binary form
+//   static T readBinary(const std::string& in, size_t& pos);
+//   static void writeText(std::string& out, const T& value);          - form used inside "(()key:value())"
+//   static T readText(const std::string& in, size_t& pos);
+//
+// Binary scalars are fixed width little-endian, strings are a varint length followed by bytes.
+// In text, the characters ( ) , : and \ inside strings are escaped with a backslash, so a
+// reader always stops at the first unescaped one of them.
+// Specialize Codec for your own value types to make them serializable.
+template<typename T>
+struct Codec;
+
+template<typename T, typename = void>
+struct HasCodec : std::false_type {};
+
+template<typename T>
+struct HasCodec<T, std::void_t<decltype(Codec<T>::tag)>> : std::true_type {};
+
+
+namespace Codecs {
+
+    inline void WriteU64(std::string& out, uint64_t v, int bytes = 8) {
+        for (int i = 0; i < bytes; ++i) out += static_cast<char>((v >> (8 * i)) & 0xFF);
+    }
+
+    inline uint64_t ReadU64(const std::string& in, size_t& pos, int bytes = 8) {
+        if (pos > in.size() || in.size() - pos < static_cast<size_t>(bytes)) throw Errors::DeserializeFailed();
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; ++i) v |= static_cast<uint64_t>(static_cast<unsigned char>(in[pos + i])) << (8 * i);
+        pos += bytes;
+        return v;
+    }
+
+    inline void WriteVarint(std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out += static_cast<char>((v & 0x7F) | 0x80);
+            v >>= 7;
+        }
+        out += static_cast<char>(v);
+    }
+
+    inline uint64_t ReadVarint(const std::string& in, size_t& pos) {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= in.size()) throw Errors::DeserializeFailed();
+            unsigned char b = static_cast<unsigned char>(in[pos++]);
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        throw Errors::DeserializeFailed();
+    }
+
+    inline void WriteBytes(std::string& out, const std::string& s) {
+        WriteVarint(out, s.size());
+        out += s;
+    }
+
+    inline std::string ReadBytes(const std::string& in, size_t& pos) {
+        uint64_t len = ReadVarint(in, pos);
+        if (len > in.size() - pos) throw Errors::DeserializeFailed();
+        std::string s = in.substr(pos, len);
+        pos += len;
+        return s;
+    }
+
+    inline bool IsSpecial(char c) {
+        return c == '(' || c == ')' || c == ',' || c == ':' || c == '\\';
+    }
+
+    inline void WriteEscaped(std::string& out, const std::string& s) {
+        for (char c : s) {
+            if (IsSpecial(c)) out += '\\';
+            out += c;
+        }
+    }
+
+    inline std::string ReadEscaped(const std::string& in, size_t& pos) {
+        std::string s;
+        while (pos < in.size() && (in[pos] == '\\' || !IsSpecial(in[pos]))) {
+            if (in[pos] == '\\') {
+                if (++pos >= in.size()) throw Errors::ParseError("Dangling escape character");
+            }
+            s += in[pos++];
+        }
+        return s;
+    }
+
+    inline void Expect(const std::string& in, size_t& pos, char c) {
+        if (pos >= in.size() || in[pos] != c) throw Errors::ParseError(std::string("Expected '") + c + "'");
+        ++pos;
+    }
+
+    template<typename N>
+    void WriteNumber(std::string& out, N v) {
+        char buf[64];
+        auto res = std::to_chars(buf, buf + sizeof(buf), v);
+        out.append(buf, res.ptr);
+    }
+
+    template<typename N>
+    N ReadNumber(const std::string& in, size_t& pos) {
+        N v{};
+        const char* first = in.data() + pos;
+        auto res = std::from_chars(first, in.data() + in.size(), v);
+        if (res.ec != std::errc()) throw Errors::ParseError("Invalid number");
+        pos += res.ptr - first;
+        return v;
+    }
+}
+
+
+template<>
+struct Codec<int> {
+    static constexpr const char* tag = "int";
+
+    static void writeBinary(std::string& out, const int& v) { Codecs::WriteU64(out, static_cast<uint32_t>(v), 4); }
+    static int readBinary(const std::string& in, size_t& pos) { return static_cast<int32_t>(Codecs::ReadU64(in, pos, 4)); }
+
+    static void writeText(std::string& out, const int& v) { Codecs::WriteNumber(out, v); }
+    static int readText(const std::string& in, size_t& pos) { return Codecs::ReadNumber<int>(in, pos); }
+};
+
+template<>
+struct Codec<bool> {
+    static constexpr const char* tag = "bool";
+
+    static void writeBinary(std::string& out, const bool& v) { out += static_cast<char>(v ? 1 : 0); }
+    static bool readBinary(const std::string& in, size_t& pos) { return Codecs::ReadU64(in, pos, 1) != 0; }
+
+    static void writeText(std::string& out, const bool& v) { out += v ? '1' : '0'; }
+    static bool readText(const std::string& in, size_t& pos) { return Codecs::ReadNumber<int>(in, pos) != 0; }
+};
+
+template<>
+struct Codec<double> {
+    static constexpr const char* tag = "double";
+
+    static void writeBinary(std::string& out, const double& v) {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        Codecs::WriteU64(out, bits);
+    }
+    static double readBinary(const std::string& in, size_t& pos) {
+        uint64_t bits = Codecs::ReadU64(in, pos);
+        double v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    static void writeText(std::string& out, const double& v) { Codecs::WriteNumber(out, v); }
+    static double readText(const std::string& in, size_t& pos) { return Codecs::ReadNumber<double>(in, pos); }
+};
+
+template<>
+struct Codec<std::string> {
+    static constexpr const char* tag = "string";
+
+    static void writeBinary(std::string& out, const std::string& v) { Codecs::WriteBytes(out, v); }
+    static std::string readBinary(const std::string& in, size_t& pos) { return Codecs::ReadBytes(in, pos); }
+
+    static void writeText(std::string& out, const std::string& v) { Codecs::WriteEscaped(out, v); }
+    static std::string readText(const std::string& in, size_t& pos) { return Codecs::ReadEscaped(in, pos); }
+};
+
+template<>
+struct Codec<std::complex<double>> {
+    static constexpr const char* tag = "complex";
+
+    static void writeBinary(std::string& out, const std::complex<double>& v) {
+        Codec<double>::writeBinary(out, v.real());
+        Codec<double>::writeBinary(out, v.imag());
+    }
+    static std::complex<double> readBinary(const std::string& in, size_t& pos) {
+        double re = Codec<double>::readBinary(in, pos);
+        double im = Codec<double>::readBinary(in, pos);
+        return { re, im };
+    }
+
+    static void writeText(std::string& out, const std::complex<double>& v) {
+        Codec<double>::writeText(out, v.real());
+        out += ',';
+        Codec<double>::writeText(out, v.imag());
+    }
+    static std::complex<double> readText(const std::string& in, size_t& pos) {
+        double re = Codec<double>::readText(in, pos);
+        Codecs::Expect(in, pos, ',');
+        double im = Codec<double>::readText(in, pos);
+        return { re, im };
+    }
+};
+
+
+
+namespace Codecs {
+
+    inline uint64_t HashMix(uint64_t h) {
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    }
+}
+
+// ValueHash<T> must agree with T::operator==. It uses std::hash when available and
+// otherwise hashes the binary Codec encoding; specialize it when neither fits.
+template<typename T>
+struct ValueHash {
+    size_t operator()(const T& value) const {
+        if constexpr (std::is_default_constructible_v<std::hash<T>>) {
+            return std::hash<T>{}(value);
+        }
+        else if constexpr (HasCodec<T>::value) {
+            // The encoding goes to a per-thread buffer that keeps its capacity, so hashing
+            // does not allocate once the buffer has grown to the largest value seen.
+            static thread_local std::string bytes;
+            bytes.clear();
+            Codec<T>::writeBinary(bytes, value);
+            return std::hash<std::string_view>{}(bytes);
+        }
+        else {
+            return 0;
+        }
+    }
+};
+
+template<>
+struct ValueHash<std::complex<double>> {
+    size_t operator()(const std::complex<double>& value) const {
+        return Codecs::HashMix(std::hash<double>{}(value.real()) ^ Codecs::HashMix(std::hash<double>{}(value.imag())));
+    }
+};
\ No newline at end of file
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+#include <climits>
+#include <type_traits>
+#include <algorithm>
+#include "BinaryTree.hpp"
+#include "User.hpp"
+#include "error.hpp"
+
+// Column-wise copy of a tree of User-derived records: every field is a contiguous array and
+// row i holds the record with the i-th smallest key. Scans over ages and flags touch only
+// those arrays, and their loops are branch-free so the compiler turns them into SIMD code at
+// -O2 and above, which both make targets use.
+//
+// The store is a snapshot; rebuild it with fromTree() after the tree changes. Student's group
+// and exam_pass go to the `label` and `flag` columns, and so do Professor's subject and
+// be_on_exam. Plain Users leave both empty.
+template<typename T>
+class ColumnStore {
+    static_assert(std::is_base_of_v<User, T>, "ColumnStore holds User, Student or Professor records");
+
+private:
+    std::vector<int> keys;
+    std::vector<int32_t> ages;
+    std::vector<int32_t> ids;
+    std::vector<uint8_t> flags;
+    std::vector<std::string> names;
+    std::vector<std::string> labels;
+
+    static const size_t BLOCK = 64;
+
+    void append(int key, const T& record);
+    size_t clampLast(size_t last) const;
+
+    template<typename Acc, typename F>
+    static Acc blockSum(size_t first, size_t last, F term);
+
+public:
+    static const size_t npos = SIZE_MAX;
+
+    size_t Size() const;
+    int key(size_t row) const;
+    T row(size_t row) const;
+    size_t find(int key) const;
+    std::pair<size_t, size_t> rows(int keyLo, int keyHi) const;
+
+    // Scans over rows [first, last); the age bounds are inclusive.
+    size_t countAge(int lo, int hi, size_t first = 0, size_t last = npos) const;
+    size_t countFlagged(int lo, int hi, size_t first = 0, size_t last = npos) const;
+    int64_t sumAge(size_t first = 0, size_t last = npos) const;
+    double meanAge(size_t first = 0, size_t last = npos) const;
+    std::vector<size_t> selectAge(int lo, int hi, size_t first = 0, size_t last = npos) const;
+
+    static ColumnStore<T> fromTree(const BinaryTree<T>& tree);
+};
+
+
+
+template<typename T>
+void ColumnStore<T>::append(int key, const T& record) {
+    keys.push_back(key);
+    ages.push_back(record.age);
+    ids.push_back(record.id);
+    names.push_back(record.name);
+    if constexpr (std::is_base_of_v<Student, T>) {
+        flags.push_back(record.exam_pass ? 1 : 0);
+        labels.push_back(record.group);
+    }
+    else if constexpr (std::is_base_of_v<Professor, T>) {
+        flags.push_back(record.be_on_exam ? 1 : 0);
+        labels.push_back(record.subject);
+    }
+    else {
+        flags.push_back(0);
+        labels.emplace_back();
+    }
+}
+
+template<typename T>
+template<typename Acc, typename F>
+Acc ColumnStore<T>::blockSum(size_t first, size_t last, F term) {
+    // Sums term(i) over [first, last). GCC vectorizes the fixed-length inner loop already at
+    // -O2, where its cost model leaves loops of unknown length scalar; the tail runs scalar.
+    Acc total = 0;
+    size_t i = first;
+    for (; i + BLOCK <= last; i += BLOCK) {
+        Acc block = 0;
+        for (size_t j = 0; j < BLOCK; ++j) block += term(i + j);
+        total += block;
+    }
+    for (; i < last; ++i) total += term(i);
+    return total;
+}
+
+template<typename T>
+size_t ColumnStore<T>::clampLast(size_t last) const {
+    return std::min(last, keys.size());
+}
+
+template<typename T>
+size_t ColumnStore<T>::Size() const {
+    return keys.size();
+}
+
+template<typename T>
+int ColumnStore<T>::key(size_t row) const {
+    if (row >= keys.size()) throw Errors::IndexOutOfRange();
+    return keys[row];
+}
+
+template<typename T>
+T ColumnStore<T>::row(size_t row) const {
+    if (row >= keys.size()) throw Errors::IndexOutOfRange();
+    T record;
+    record.name = names[row];
+    record.age = ages[row];
+    record.id = ids[row];
+    if constexpr (std::is_base_of_v<Student, T>) {
+        record.group = labels[row];
+        record.exam_pass = flags[row] != 0;
+    }
+    else if constexpr (std::is_base_of_v<Professor, T>) {
+        record.subject = labels[row];
+        record.be_on_exam = flags[row] != 0;
+    }
+    return record;
+}
+
+template<typename T>
+size_t ColumnStore<T>::find(int key) const {
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+    return it != keys.end() && *it == key ? static_cast<size_t>(it - keys.begin()) : npos;
+}
+
+template<typename T>
+std::pair<size_t, size_t> ColumnStore<T>::rows(int keyLo, int keyHi) const {
+    size_t first = std::lower_bound(keys.begin(), keys.end(), keyLo) - keys.begin();
+    size_t last = std::upper_bound(keys.begin(), keys.end(), keyHi) - keys.begin();
+    return { first, std::max(first, last) };
+}
+
+template<typename T>
+size_t ColumnStore<T>::countAge(int lo, int hi, size_t first, size_t last) const {
+    last = clampLast(last);
+    if (lo > hi || first >= last) return 0;
+    // lo <= age <= hi as one unsigned comparison, so the loop body has no branches.
+    const int32_t* age = ages.data();
+    uint32_t base = static_cast<uint32_t>(lo), width = static_cast<uint32_t>(hi) - base;
+    return blockSum<size_t>(first, last, [=](size_t i) -> uint32_t { return static_cast<uint32_t>(age[i]) - base <= width; });
+}
+
+template<typename T>
+size_t ColumnStore<T>::countFlagged(int lo, int hi, size_t first, size_t last) const {
+    last = clampLast(last);
+    if (lo > hi || first >= last) return 0;
+    const int32_t* age = ages.data();
+    const uint8_t* flag = flags.data();
+    uint32_t base = static_cast<uint32_t>(lo), width = static_cast<uint32_t>(hi) - base;
+    return blockSum<size_t>(first, last, [=](size_t i) -> uint32_t { return (static_cast<uint32_t>(age[i]) - base <= width) & flag[i]; });
+}
+
+template<typename T>
+int64_t ColumnStore<T>::sumAge(size_t first, size_t last) const {
+    last = clampLast(last);
+    const int32_t* age = ages.data();
+    return first < last ? blockSum<int64_t>(first, last, [=](size_t i) -> int64_t { return age[i]; }) : 0;
+}
+
+template<typename T>
+double ColumnStore<T>::meanAge(size_t first, size_t last) const {
+    last = clampLast(last);
+    return first < last ? static_cast<double>(sumAge(first, last)) / (last - first) : 0;
+}
+
+template<typename T>
+std::vector<size_t> ColumnStore<T>::selectAge(int lo, int hi, size_t first, size_t last) const {
+    std::vector<size_t> result;
+    last = clampLast(last);
+    if (lo > hi || first >= last) return result;
+    result.reserve(countAge(lo, hi, first, last));
+    uint32_t base = static_cast<uint32_t>(lo), width = static_cast<uint32_t>(hi) - base;
+    for (size_t i = first; i < last; ++i) {
+        if (static_cast<uint32_t>(ages[i]) - base <= width) result.push_back(i);
+    }
+    return result;
+}
+
+template<typename T>
+ColumnStore<T> ColumnStore<T>::fromTree(const BinaryTree<T>& tree) {
+    ColumnStore<T> store;
+    tree.traverseRange(INT_MIN, INT_MAX, [&store](int key, const T& record) { store.append(key, record); });
+    return store;
+}
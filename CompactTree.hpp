@@ -0,0 +1,406 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+#include "BinaryTree.hpp"
+#include "Memory.hpp"
+#include "error.hpp"
+
+// Binary search tree whose nodes live in one contiguous array and refer to their children by
+// 32-bit slot numbers. A CompactBinaryTree<int> node takes 16 bytes (a BinaryTree<int> node
+// takes 32 on 64-bit builds plus malloc overhead; memoryUsage() of either tree reports the
+// sizeof figures), copying is a single array copy (a memcpy for trivially copyable T) and
+// destruction frees a single block. Removed slots are reused by later inserts;
+// balance() rebuilds the array in preorder, which also drops the holes.
+//
+// With ColdValues the values are kept out of line in a separate column and a node holds only
+// the key, the links and the slot of its value (16 bytes whatever T is). Searches then pull
+// only keys into the cache, and balance() moves nodes without ever touching a value. It is on
+// by default for values larger than 16 bytes, such as Student and Professor.
+//
+// There is no checkpointing, hashing or height bound here; call balance() after bulk changes.
+template<typename T, bool ColdValues = (sizeof(T) > 16)>
+class CompactBinaryTree {
+private:
+    static const uint32_t NIL = UINT32_MAX;
+
+    struct InlineNode {
+        int key;
+        uint32_t left;
+        uint32_t right;
+        T value;
+    };
+
+    struct ColdNode {
+        int key;
+        uint32_t left;
+        uint32_t right;
+        uint32_t value;   // slot in `values`
+    };
+
+    using Node = std::conditional_t<ColdValues, ColdNode, InlineNode>;
+
+    std::vector<Node> nodes;
+    uint32_t root;
+    uint32_t freeList;   // removed slots, chained through `left`
+    int size;
+
+    std::vector<T> values;             // value column, ColdValues only
+    std::vector<uint32_t> freeValues;  // removed value slots, ColdValues only
+
+    T& valueOf(Node& node);
+    const T& valueOf(const Node& node) const;
+    Node makeNode(int key, const T& value);
+    uint32_t allocate(int key, const T& value);
+    void release(uint32_t slot);
+    uint32_t find(int key) const;
+    uint32_t build(std::vector<Node>& out, const std::vector<uint32_t>& order, size_t lo, size_t hi) const;
+
+    template<typename F>
+    void walk(const std::string& order, F func) const;
+
+public:
+    CompactBinaryTree();
+
+    void insert(int key, const T& value);
+    bool remove(int key);
+    T* search(int key);
+    const T* search(int key) const;
+    T getMin() const;
+    T getMax() const;
+
+    void traverseKLP(std::function<void(const T&)> func) const;
+    void traverseLKP(std::function<void(const T&)> func) const;
+    void traverseLPK(std::function<void(const T&)> func) const;
+    void traverseRange(int lo, int hi, std::function<void(int, const T&)> func) const;
+
+    void balance();
+    int GetDepth() const;
+    int Size() const;
+    MemoryUsage memoryUsage() const;
+
+    static CompactBinaryTree<T, ColdValues> fromTree(const BinaryTree<T>& tree);
+};
+
+
+
+template<typename T, bool ColdValues>
+CompactBinaryTree<T, ColdValues>::CompactBinaryTree() : root(NIL), freeList(NIL), size(0) {}
+
+template<typename T, bool ColdValues>
+T& CompactBinaryTree<T, ColdValues>::valueOf(Node& node) {
+    if constexpr (ColdValues) return values[node.value];
+    else return node.value;
+}
+
+template<typename T, bool ColdValues>
+const T& CompactBinaryTree<T, ColdValues>::valueOf(const Node& node) const {
+    if constexpr (ColdValues) return values[node.value];
+    else return node.value;
+}
+
+template<typename T, bool ColdValues>
+typename CompactBinaryTree<T, ColdValues>::Node CompactBinaryTree<T, ColdValues>::makeNode(int key, const T& value) {
+    if constexpr (ColdValues) {
+        uint32_t slot;
+        if (!freeValues.empty()) {
+            slot = freeValues.back();
+            freeValues.pop_back();
+            values[slot] = value;
+        }
+        else {
+            if (values.size() >= NIL) throw Errors::IndexOutOfRange();
+            slot = static_cast<uint32_t>(values.size());
+            values.push_back(value);
+        }
+        return Node{ key, NIL, NIL, slot };
+    }
+    else {
+        return Node{ key, NIL, NIL, value };
+    }
+}
+
+template<typename T, bool ColdValues>
+uint32_t CompactBinaryTree<T, ColdValues>::allocate(int key, const T& value) {
+    if (freeList != NIL) {
+        uint32_t slot = freeList;
+        freeList = nodes[slot].left;
+        nodes[slot] = makeNode(key, value);
+        ++size;
+        return slot;
+    }
+    if (nodes.size() >= NIL) throw Errors::IndexOutOfRange();
+    nodes.push_back(makeNode(key, value));
+    ++size;
+    return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+template<typename T, bool ColdValues>
+void CompactBinaryTree<T, ColdValues>::release(uint32_t slot) {
+    --size;
+    valueOf(nodes[slot]) = T();
+    if constexpr (ColdValues) freeValues.push_back(nodes[slot].value);
+    nodes[slot].right = NIL;
+    nodes[slot].left = freeList;
+    freeList = slot;
+}
+
+template<typename T, bool ColdValues>
+uint32_t CompactBinaryTree<T, ColdValues>::find(int key) const {
+    uint32_t slot = root;
+    while (slot != NIL) {
+        const Node& node = nodes[slot];
+        if (key == node.key) return slot;
+        slot = key < node.key ? node.left : node.right;
+    }
+    return NIL;
+}
+
+template<typename T, bool ColdValues>
+void CompactBinaryTree<T, ColdValues>::insert(int key, const T& value) {
+    uint32_t parent = NIL;
+    uint32_t slot = root;
+    while (slot != NIL) {
+        Node& node = nodes[slot];
+        if (key == node.key) {
+            valueOf(node) = value;
+            return;
+        }
+        parent = slot;
+        slot = key < node.key ? node.left : node.right;
+    }
+
+    // allocate() may grow the array, so the parent is looked up again afterwards.
+    uint32_t fresh = allocate(key, value);
+    if (parent == NIL) root = fresh;
+    else if (key < nodes[parent].key) nodes[parent].left = fresh;
+    else nodes[parent].right = fresh;
+}
+
+template<typename T, bool ColdValues>
+bool CompactBinaryTree<T, ColdValues>::remove(int key) {
+    uint32_t parent = NIL;
+    uint32_t slot = root;
+    while (slot != NIL && nodes[slot].key != key) {
+        parent = slot;
+        slot = key < nodes[slot].key ? nodes[slot].left : nodes[slot].right;
+    }
+    if (slot == NIL) return false;
+
+    Node& node = nodes[slot];
+    uint32_t replacement;
+    if (node.left == NIL) replacement = node.right;
+    else if (node.right == NIL) replacement = node.left;
+    else {
+        // The in-order successor takes the place of the node; no value is copied.
+        uint32_t succParent = slot;
+        uint32_t succ = node.right;
+        while (nodes[succ].left != NIL) {
+            succParent = succ;
+            succ = nodes[succ].left;
+        }
+        if (succParent != slot) {
+            nodes[succParent].left = nodes[succ].right;
+            nodes[succ].right = node.right;
+        }
+        nodes[succ].left = node.left;
+        replacement = succ;
+    }
+
+    if (parent == NIL) root = replacement;
+    else if (nodes[parent].left == slot) nodes[parent].left = replacement;
+    else nodes[parent].right = replacement;
+
+    release(slot);
+    return true;
+}
+
+template<typename T, bool ColdValues>
+T* CompactBinaryTree<T, ColdValues>::search(int key) {
+    uint32_t slot = find(key);
+    return slot == NIL ? nullptr : &valueOf(nodes[slot]);
+}
+
+template<typename T, bool ColdValues>
+const T* CompactBinaryTree<T, ColdValues>::search(int key) const {
+    uint32_t slot = find(key);
+    return slot == NIL ? nullptr : &valueOf(nodes[slot]);
+}
+
+template<typename T, bool ColdValues>
+T CompactBinaryTree<T, ColdValues>::getMin() const {
+    if (root == NIL) throw Errors::TreeEmpty();
+    uint32_t slot = root;
+    while (nodes[slot].left != NIL) slot = nodes[slot].left;
+    return valueOf(nodes[slot]);
+}
+
+template<typename T, bool ColdValues>
+T CompactBinaryTree<T, ColdValues>::getMax() const {
+    if (root == NIL) throw Errors::TreeEmpty();
+    uint32_t slot = root;
+    while (nodes[slot].right != NIL) slot = nodes[slot].right;
+    return valueOf(nodes[slot]);
+}
+
+template<typename T, bool ColdValues>
+template<typename F>
+void CompactBinaryTree<T, ColdValues>::walk(const std::string& order, F func) const {
+    // Iterative, so degenerate trees don't overflow the call stack. Each slot is pushed once to
+    // expand it and once more to visit it.
+    const bool pre = order == "KLP", in = order == "LKP", post = order == "LPK";
+    if (!pre && !in && !post) throw Errors::UnknownOrder(order);
+
+    std::vector<std::pair<uint32_t, bool>> stack;
+    if (root != NIL) stack.push_back({ root, false });
+    while (!stack.empty()) {
+        auto [slot, visit] = stack.back();
+        stack.pop_back();
+        const Node& node = nodes[slot];
+        if (visit) {
+            func(node);
+            continue;
+        }
+
+        if (post) stack.push_back({ slot, true });
+        if (node.right != NIL) stack.push_back({ node.right, false });
+        if (in) stack.push_back({ slot, true });
+        if (node.left != NIL) stack.push_back({ node.left, false });
+        if (pre) stack.push_back({ slot, true });
+    }
+}
+
+template<typename T, bool ColdValues>
+void CompactBinaryTree<T, ColdValues>::traverseKLP(std::function<void(const T&)> func) const {
+    walk("KLP", [&](const Node& n) { func(valueOf(n)); });
+}
+
+template<typename T, bool ColdValues>
+void CompactBinaryTree<T, ColdValues>::traverseLKP(std::function<void(const T&)> func) const {
+    walk("LKP", [&](const Node& n) { func(valueOf(n)); });
+}
+
+template<typename T, bool ColdValues>
+void CompactBinaryTree<T, ColdValues>::traverseLPK(std::function<void(const T&)> func) const {
+    walk("LPK", [&](const Node& n) { func(valueOf(n)); });
+}
+
+template<typename T, bool ColdValues>
+void CompactBinaryTree<T, ColdValues>::traverseRange(int lo, int hi, std::function<void(int, const T&)> func) const {
+    std::vector<uint32_t> stack;
+    uint32_t slot = root;
+    while (slot != NIL || !stack.empty()) {
+        while (slot != NIL) {
+            if (nodes[slot].key < lo) slot = nodes[slot].right;
+            else {
+                stack.push_back(slot);
+                slot = nodes[slot].left;
+            }
+        }
+        if (stack.empty()) return;
+        slot = stack.back();
+        stack.pop_back();
+        if (nodes[slot].key > hi) return;
+        func(nodes[slot].key, valueOf(nodes[slot]));
+        slot = nodes[slot].right;
+    }
+}
+
+template<typename T, bool ColdValues>
+uint32_t CompactBinaryTree<T, ColdValues>::build(std::vector<Node>& out, const std::vector<uint32_t>& order, size_t lo, size_t hi) const {
+    if (lo >= hi) return NIL;
+    size_t mid = lo + (hi - lo) / 2;
+    uint32_t slot = static_cast<uint32_t>(out.size());
+    out.push_back(nodes[order[mid]]);
+    uint32_t left = build(out, order, lo, mid);
+    uint32_t right = build(out, order, mid + 1, hi);
+    out[slot].left = left;
+    out[slot].right = right;
+    return slot;
+}
+
+template<typename T, bool ColdValues>
+void CompactBinaryTree<T, ColdValues>::balance() {
+    std::vector<uint32_t> order;
+    order.reserve(size);
+    walk("LKP", [&](const Node& node) { order.push_back(static_cast<uint32_t>(&node - nodes.data())); });
+
+    std::vector<Node> out;
+    out.reserve(order.size());
+    root = build(out, order, 0, order.size());
+    nodes.swap(out);
+    freeList = NIL;
+}
+
+template<typename T, bool ColdValues>
+int CompactBinaryTree<T, ColdValues>::GetDepth() const {
+    int depth = 0;
+    std::vector<std::pair<uint32_t, int>> stack;
+    if (root != NIL) stack.push_back({ root, 1 });
+    while (!stack.empty()) {
+        auto [slot, d] = stack.back();
+        stack.pop_back();
+        depth = std::max(depth, d);
+        if (nodes[slot].left != NIL) stack.push_back({ nodes[slot].left, d + 1 });
+        if (nodes[slot].right != NIL) stack.push_back({ nodes[slot].right, d + 1 });
+    }
+    return depth;
+}
+
+template<typename T, bool ColdValues>
+int CompactBinaryTree<T, ColdValues>::Size() const {
+    return size;
+}
+
+template<typename T, bool ColdValues>
+MemoryUsage CompactBinaryTree<T, ColdValues>::memoryUsage() const {
+    MemoryUsage usage;
+    HeapUsage heap;
+    walk("KLP", [&](const Node& node) { HeapBytes<T>{}(valueOf(node), heap); });
+
+    usage.nodes = size;
+    usage.valuePayload = usage.nodes * sizeof(T);
+    usage.valueHeap = heap.bytes;
+    usage.allocatorSlack = heap.slack;
+
+    // Free and reserved slots count as slack; each array is one malloc block.
+    size_t arrayBytes = nodes.capacity() * sizeof(Node);
+    if (arrayBytes) usage.allocatorSlack += Memory::Slack(arrayBytes);
+    usage.allocatorSlack += (nodes.capacity() - usage.nodes) * sizeof(Node);
+
+    if constexpr (ColdValues) {
+        usage.nodeOverhead = usage.nodes * sizeof(Node) + freeValues.capacity() * sizeof(uint32_t);
+        size_t columnBytes = values.capacity() * sizeof(T);
+        if (columnBytes) usage.allocatorSlack += Memory::Slack(columnBytes);
+        usage.allocatorSlack += (values.capacity() - usage.nodes) * sizeof(T);
+    }
+    else {
+        usage.nodeOverhead = usage.nodes * (sizeof(Node) - sizeof(T));
+    }
+    return usage;
+}
+
+template<typename T, bool ColdValues>
+CompactBinaryTree<T, ColdValues> CompactBinaryTree<T, ColdValues>::fromTree(const BinaryTree<T>& tree) {
+    // Collect the nodes in key order, then lay them out as a balanced tree in preorder.
+    CompactBinaryTree<T, ColdValues> result;
+    tree.traverseRange(INT_MIN, INT_MAX, [&](int key, const T& value) {
+        if (result.nodes.size() >= NIL) throw Errors::IndexOutOfRange();
+        result.nodes.push_back(result.makeNode(key, value));
+    });
+
+    std::vector<uint32_t> order(result.nodes.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<uint32_t>(i);
+
+    std::vector<Node> out;
+    out.reserve(order.size());
+    result.root = result.build(out, order, 0, order.size());
+    result.nodes.swap(out);
+    result.size = static_cast<int>(order.size());
+    return result;
+}
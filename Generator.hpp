@@ -0,0 +1,300 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include "BinaryTree.hpp"
+#include "Codec.hpp"
+#include "error.hpp"
+
+const size_t MAX_GENERATED_KEYS = 100'000'000;
+
+// Uniform     - keys spread evenly over the key range, random insertion order.
+// Sorted      - ascending insertion order. Reverse - descending insertion order.
+// Zipfian     - power-law gaps between keys (dense head, sparse tail), random insertion order.
+// Clustered   - runs of consecutive keys far apart from each other, inserted run by run.
+// Adversarial - alternating min/max insertion order, which degenerates a plain BST into a path.
+enum class KeyDistribution {
+    Uniform,
+    Sorted,
+    Reverse,
+    Zipfian,
+    Clustered,
+    Adversarial
+};
+
+// Balanced - built directly from the sorted keys. Inserted - keys inserted in distribution order.
+enum class TreeShape {
+    Balanced,
+    Inserted
+};
+
+inline KeyDistribution ParseDistribution(const std::string& name) {
+    if (name == "uniform") return KeyDistribution::Uniform;
+    if (name == "sorted") return KeyDistribution::Sorted;
+    if (name == "reverse") return KeyDistribution::Reverse;
+    if (name == "zipfian") return KeyDistribution::Zipfian;
+    if (name == "clustered") return KeyDistribution::Clustered;
+    if (name == "adversarial") return KeyDistribution::Adversarial;
+    throw Errors::InvalidArgument("Unknown distribution: " + name);
+}
+
+inline std::string DistributionName(KeyDistribution dist) {
+    switch (dist) {
+    case KeyDistribution::Uniform: return "uniform";
+    case KeyDistribution::Sorted: return "sorted";
+    case KeyDistribution::Reverse: return "reverse";
+    case KeyDistribution::Zipfian: return "zipfian";
+    case KeyDistribution::Clustered: return "clustered";
+    case KeyDistribution::Adversarial: return "adversarial";
+    }
+    return "unknown";
+}
+
+inline unsigned DefaultThreads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Runs f(begin, end) over [0, n) split into one contiguous chunk per thread.
+template<typename F>
+void ParallelFor(size_t n, unsigned threads, F f) {
+    threads = static_cast<unsigned>(std::min<size_t>(std::max(1u, threads), std::max<size_t>(1, n / 4096)));
+    if (threads <= 1) {
+        f(size_t(0), n);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    size_t chunk = (n + threads - 1) / threads;
+    for (unsigned t = 0; t < threads; ++t) {
+        size_t begin = std::min(n, t * chunk), end = std::min(n, begin + chunk);
+        workers.emplace_back(f, begin, end);
+    }
+    for (auto& worker : workers) worker.join();
+}
+
+// Stateless per-index random numbers, so chunks can be generated in any order on any thread.
+inline uint64_t RandomAt(uint64_t seed, uint64_t i) {
+    return Codecs::HashMix(seed ^ Codecs::HashMix(i + 0x9e3779b97f4a7c15ULL));
+}
+
+inline double UnitAt(uint64_t seed, uint64_t i) {
+    return (RandomAt(seed, i) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Sorted distinct keys with the spacing of the distribution; every key fits into [0, INT_MAX].
+inline std::vector<int> GenerateKeySet(size_t n, KeyDistribution dist, uint64_t seed, unsigned threads = DefaultThreads()) {
+    if (n > MAX_GENERATED_KEYS) throw Errors::InvalidArgument("Can't generate more than 100000000 keys.");
+
+    std::vector<int> keys(n);
+    if (n == 0) return keys;
+
+    // Average room per key. Every distribution stays below `domain`, so small trees keep their
+    // keys in [0, 1000] like the old RandomTree.
+    uint64_t domain = std::min<uint64_t>(INT_MAX, std::max<uint64_t>(1001, n * 16));
+    uint64_t step = std::max<uint64_t>(1, domain / n);
+
+    switch (dist) {
+    case KeyDistribution::Uniform:
+        ParallelFor(n, threads, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) keys[i] = static_cast<int>(i * step + RandomAt(seed, i) % step);
+        });
+        break;
+
+    case KeyDistribution::Sorted:
+    case KeyDistribution::Reverse:
+    case KeyDistribution::Adversarial:
+        ParallelFor(n, threads, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) keys[i] = static_cast<int>(i);
+        });
+        break;
+
+    case KeyDistribution::Clustered: {
+        // Each run gets an equal share of the domain, so the last one still ends inside it.
+        const size_t run = 256;
+        uint64_t stride = domain / ((n + run - 1) / run);
+        ParallelFor(n, threads, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                size_t cluster = i / run;
+                uint64_t offset = stride > run ? RandomAt(seed, cluster) % (stride - run + 1) : 0;
+                keys[i] = static_cast<int>(cluster * stride + offset + i % run);
+            }
+        });
+        break;
+    }
+
+    case KeyDistribution::Zipfian: {
+        // Gaps follow a power law capped at `step`, so the total never leaves the domain.
+        auto gap = [&](size_t i) {
+            double g = std::floor(std::pow(1.0 - UnitAt(seed, i), -1.0 / 1.1));
+            return static_cast<uint64_t>(std::min<double>(static_cast<double>(step), std::max(1.0, g)));
+        };
+
+        unsigned parts = std::max(1u, threads);
+        size_t chunk = (n + parts - 1) / parts;
+        std::vector<uint64_t> offsets(parts + 1, 0);
+        ParallelFor(parts, parts, [&](size_t begin, size_t end) {
+            for (size_t p = begin; p < end; ++p) {
+                uint64_t sum = 0;
+                for (size_t i = p * chunk; i < std::min(n, (p + 1) * chunk); ++i) sum += gap(i);
+                offsets[p + 1] = sum;
+            }
+        });
+        for (unsigned p = 0; p < parts; ++p) offsets[p + 1] += offsets[p];
+        ParallelFor(parts, parts, [&](size_t begin, size_t end) {
+            for (size_t p = begin; p < end; ++p) {
+                uint64_t key = offsets[p];
+                for (size_t i = p * chunk; i < std::min(n, (p + 1) * chunk); ++i) {
+                    key += gap(i);
+                    keys[i] = static_cast<int>(key - 1);
+                }
+            }
+        });
+        break;
+    }
+    }
+
+    return keys;
+}
+
+// Reorders sorted keys into the insertion order of the distribution.
+inline void ApplyInsertionOrder(std::vector<int>& keys, KeyDistribution dist, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+
+    switch (dist) {
+    case KeyDistribution::Uniform:
+    case KeyDistribution::Zipfian:
+        std::shuffle(keys.begin(), keys.end(), rng);
+        break;
+
+    case KeyDistribution::Sorted:
+        break;
+
+    case KeyDistribution::Reverse:
+        std::reverse(keys.begin(), keys.end());
+        break;
+
+    case KeyDistribution::Clustered: {
+        const size_t run = 256;
+        std::vector<size_t> clusters((keys.size() + run - 1) / run);
+        for (size_t c = 0; c < clusters.size(); ++c) clusters[c] = c;
+        std::shuffle(clusters.begin(), clusters.end(), rng);
+
+        std::vector<int> ordered;
+        ordered.reserve(keys.size());
+        for (size_t c : clusters) {
+            for (size_t i = c * run; i < std::min(keys.size(), (c + 1) * run); ++i) ordered.push_back(keys[i]);
+        }
+        keys.swap(ordered);
+        break;
+    }
+
+    case KeyDistribution::Adversarial: {
+        std::vector<int> ordered;
+        ordered.reserve(keys.size());
+        for (size_t lo = 0, hi = keys.size(); lo < hi;) {
+            ordered.push_back(keys[lo++]);
+            if (lo < hi) ordered.push_back(keys[--hi]);
+        }
+        keys.swap(ordered);
+        break;
+    }
+    }
+}
+
+inline std::vector<int> GenerateKeys(size_t n, KeyDistribution dist, uint64_t seed, unsigned threads = DefaultThreads()) {
+    std::vector<int> keys = GenerateKeySet(n, dist, seed, threads);
+    ApplyInsertionOrder(keys, dist, seed);
+    return keys;
+}
+
+inline int MinHeight(size_t n) {
+    int height = 0;
+    for (size_t m = n; m > 0; m >>= 1) ++height;
+    return height;
+}
+
+// Sorted, reverse and adversarial orders insert a path of depth n into an unbounded tree, which
+// overflows the stack of the recursive insert long before 10^6 keys.
+inline bool InsertsPath(KeyDistribution dist) {
+    return dist == KeyDistribution::Sorted || dist == KeyDistribution::Reverse || dist == KeyDistribution::Adversarial;
+}
+
+// Tree with key == value. depth <= 0 means no height bound, except for orders that would insert
+// a path: those get a bound of twice the minimum height.
+inline BinaryTree<int> GenerateTree(size_t n, KeyDistribution dist, TreeShape shape, int depth, uint64_t seed,
+    unsigned threads = DefaultThreads()) {
+    int minHeight = MinHeight(n);
+    if (depth <= 0 && shape == TreeShape::Inserted && InsertsPath(dist)) depth = 2 * minHeight;
+    if (depth > 0 && depth < minHeight)
+        throw Errors::InvalidArgument("Depth " + std::to_string(depth) + " is too small for " + std::to_string(n) + " nodes.");
+
+    if (shape == TreeShape::Balanced) {
+        std::vector<int> keys = GenerateKeySet(n, dist, seed, threads);
+        return BinaryTree<int>::fromSorted(keys, keys, threads);
+    }
+
+    std::vector<int> keys = GenerateKeys(n, dist, seed, threads);
+    BinaryTree<int> tree;
+    if (depth > 0) tree.setHeightBound(depth);
+    for (int key : keys) tree.insert(key, key);
+    return tree;
+}
+
+// Draws ranks in [0, n) with P(rank = k) ~ 1 / (k + 1)^theta (Gray et al., "Quickly generating
+// billion-record synthetic databases"). Rank 0 is the hottest.
+class ZipfGenerator {
+private:
+    size_t n;
+    double theta, alpha, zetan, eta;
+    std::mt19937_64 rng;
+    std::uniform_real_distribution<double> unit;
+
+    static double zeta(size_t n, double theta) {
+        double sum = 0;
+        for (size_t i = 1; i <= n; ++i) sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        return sum;
+    }
+
+public:
+    ZipfGenerator(size_t n_, double theta_ = 0.99, uint64_t seed = 1)
+        : n(std::max<size_t>(1, n_)), theta(theta_), rng(seed), unit(0.0, 1.0) {
+        double zeta2 = zeta(2, theta);
+        zetan = zeta(n, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    size_t operator()() {
+        double u = unit(rng);
+        double uz = u * zetan;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, theta)) return std::min<size_t>(1, n - 1);
+        return std::min(n - 1, static_cast<size_t>(n * std::pow(eta * u - eta + 1.0, alpha)));
+    }
+};
+
+// Lookup sequence over existing keys; Zipfian picks hot keys by rank, everything else uniformly.
+inline std::vector<int> GenerateAccesses(const std::vector<int>& keys, size_t count, KeyDistribution dist, uint64_t seed) {
+    std::vector<int> accesses(count);
+    if (keys.empty()) return {};
+
+    if (dist == KeyDistribution::Zipfian) {
+        // Hot ranks are spread over the key set instead of sitting at the smallest keys.
+        std::vector<int> byRank = keys;
+        std::shuffle(byRank.begin(), byRank.end(), std::mt19937_64(seed ^ 0x5bd1e995));
+        ZipfGenerator zipf(byRank.size(), 0.99, seed);
+        for (auto& key : accesses) key = byRank[zipf()];
+    }
+    else {
+        std::mt19937_64 rng(seed);
+        std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+        for (auto& key : accesses) key = keys[pick(rng)];
+    }
+    return accesses;
+}
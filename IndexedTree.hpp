@@ -0,0 +1,270 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <cstdint>
+#include <climits>
+#include <type_traits>
+#include "BinaryTree.hpp"
+#include "User.hpp"
+#include "error.hpp"
+
+// Distinct strings, each stored once and named by a 32-bit id. Ids stay valid for the
+// lifetime of the pool; strings are never dropped.
+class StringPool {
+private:
+    std::deque<std::string> strings;                     // deque: elements never move
+    std::unordered_map<std::string_view, uint32_t> ids;  // views into `strings`
+
+public:
+    static const uint32_t npos = UINT32_MAX;
+
+    uint32_t intern(std::string_view s) {
+        auto it = ids.find(s);
+        if (it != ids.end()) return it->second;
+        if (strings.size() >= npos) throw Errors::IndexOutOfRange();
+        uint32_t id = static_cast<uint32_t>(strings.size());
+        strings.emplace_back(s);
+        ids.emplace(strings.back(), id);
+        return id;
+    }
+
+    // Id of s, or npos if it was never interned. Does not allocate.
+    uint32_t find(std::string_view s) const {
+        auto it = ids.find(s);
+        return it != ids.end() ? it->second : npos;
+    }
+
+    const std::string& at(uint32_t id) const {
+        if (id >= strings.size()) throw Errors::IndexOutOfRange();
+        return strings[id];
+    }
+
+    size_t Size() const { return strings.size(); }
+};
+
+enum class IndexKind { Ordered, Hashed };
+
+// BinaryTree<T> with secondary indexes on fields of the values. Each index maps a field to the
+// primary keys of the records that hold it and is updated by every insert/remove that goes
+// through this class, so the wrapped tree is only exposed read-only.
+//
+// Ordered indexes keep (field, key) pairs in a balanced tree and answer equal() and range() in
+// O(log n + k); hashed ones answer equal() in O(1 + k). String fields are interned in a shared
+// pool and indexed by id, so every distinct group or subject name is stored once; they support
+// equal() only.
+template<typename T>
+class IndexedTree {
+private:
+    struct Index {
+        std::string name;
+        IndexKind kind;
+        bool interned;
+        std::function<int(const T&)> intField;
+        std::function<const std::string&(const T&)> stringField;
+
+        std::set<std::pair<int, int>> ordered;                     // (field, key)
+        std::unordered_map<int, std::unordered_set<int>> hashed;   // field -> keys
+    };
+
+    BinaryTree<T> records;
+    std::vector<Index> indexes;
+    StringPool strings;
+
+    int fieldOf(const Index& index, const T& value);
+    void add(Index& index, int key, const T& value);
+    void erase(Index& index, int key, const T& value);
+    void addIndex(Index index);
+    const Index& indexNamed(const std::string& name) const;
+    std::vector<int> lookup(const Index& index, int field) const;
+
+public:
+    void indexInt(const std::string& name, std::function<int(const T&)> field, IndexKind kind = IndexKind::Ordered);
+    void indexString(const std::string& name, std::function<const std::string&(const T&)> field, IndexKind kind = IndexKind::Hashed);
+    void indexFields();
+    bool hasIndex(const std::string& name) const;
+
+    void insert(int key, const T& value);
+    bool remove(int key);
+    const T* search(int key) const;
+    void balance();
+    void setHeightBound(int bound);
+    const BinaryTree<T>& tree() const;
+    const StringPool& pool() const;
+
+    // Primary keys of the matching records. Ordered indexes return them sorted by field, then
+    // key; hashed ones in no particular order.
+    std::vector<int> equal(const std::string& index, int value) const;
+    std::vector<int> equal(const std::string& index, std::string_view value) const;
+    std::vector<int> range(const std::string& index, int lo, int hi) const;
+};
+
+
+
+template<typename T>
+int IndexedTree<T>::fieldOf(const Index& index, const T& value) {
+    if (index.interned) return static_cast<int>(strings.intern(index.stringField(value)));
+    return index.intField(value);
+}
+
+template<typename T>
+void IndexedTree<T>::add(Index& index, int key, const T& value) {
+    int field = fieldOf(index, value);
+    if (index.kind == IndexKind::Ordered) index.ordered.emplace(field, key);
+    else index.hashed[field].insert(key);
+}
+
+template<typename T>
+void IndexedTree<T>::erase(Index& index, int key, const T& value) {
+    int field = fieldOf(index, value);
+    if (index.kind == IndexKind::Ordered) {
+        index.ordered.erase({ field, key });
+        return;
+    }
+    auto it = index.hashed.find(field);
+    if (it == index.hashed.end()) return;
+    it->second.erase(key);
+    if (it->second.empty()) index.hashed.erase(it);
+}
+
+template<typename T>
+void IndexedTree<T>::addIndex(Index index) {
+    if (hasIndex(index.name)) throw Errors::InvalidArgument("Index already exists: " + index.name);
+    records.traverseRange(INT_MIN, INT_MAX, [&](int key, const T& value) { add(index, key, value); });
+    indexes.push_back(std::move(index));
+}
+
+template<typename T>
+const typename IndexedTree<T>::Index& IndexedTree<T>::indexNamed(const std::string& name) const {
+    for (const Index& index : indexes) {
+        if (index.name == name) return index;
+    }
+    throw Errors::InvalidArgument("Unknown index: " + name);
+}
+
+template<typename T>
+std::vector<int> IndexedTree<T>::lookup(const Index& index, int field) const {
+    std::vector<int> keys;
+    if (index.kind == IndexKind::Ordered) {
+        for (auto it = index.ordered.lower_bound({ field, INT_MIN }); it != index.ordered.end() && it->first == field; ++it) {
+            keys.push_back(it->second);
+        }
+        return keys;
+    }
+    auto it = index.hashed.find(field);
+    if (it != index.hashed.end()) keys.assign(it->second.begin(), it->second.end());
+    return keys;
+}
+
+template<typename T>
+void IndexedTree<T>::indexInt(const std::string& name, std::function<int(const T&)> field, IndexKind kind) {
+    Index index{ name, kind, false, std::move(field), nullptr, {}, {} };
+    addIndex(std::move(index));
+}
+
+template<typename T>
+void IndexedTree<T>::indexString(const std::string& name, std::function<const std::string&(const T&)> field, IndexKind kind) {
+    Index index{ name, kind, true, nullptr, std::move(field), {}, {} };
+    addIndex(std::move(index));
+}
+
+template<typename T>
+void IndexedTree<T>::indexFields() {
+    // age, ordered, for every User; group and exam_pass for Student, subject and be_on_exam
+    // for Professor.
+    indexInt("age", [](const T& v) { return v.age; });
+    if constexpr (std::is_base_of_v<Student, T>) {
+        indexString("group", [](const T& v) -> const std::string& { return v.group; });
+        indexInt("exam_pass", [](const T& v) { return v.exam_pass ? 1 : 0; });
+    }
+    else if constexpr (std::is_base_of_v<Professor, T>) {
+        indexString("subject", [](const T& v) -> const std::string& { return v.subject; });
+        indexInt("be_on_exam", [](const T& v) { return v.be_on_exam ? 1 : 0; });
+    }
+}
+
+template<typename T>
+bool IndexedTree<T>::hasIndex(const std::string& name) const {
+    for (const Index& index : indexes) {
+        if (index.name == name) return true;
+    }
+    return false;
+}
+
+template<typename T>
+void IndexedTree<T>::insert(int key, const T& value) {
+    if (const T* old = records.search(key)) {
+        for (Index& index : indexes) erase(index, key, *old);
+    }
+    records.insert(key, value);
+    for (Index& index : indexes) add(index, key, value);
+}
+
+template<typename T>
+bool IndexedTree<T>::remove(int key) {
+    const T* old = records.search(key);
+    if (!old) return false;
+    for (Index& index : indexes) erase(index, key, *old);
+    return records.remove(key);
+}
+
+template<typename T>
+const T* IndexedTree<T>::search(int key) const {
+    return records.search(key);
+}
+
+template<typename T>
+void IndexedTree<T>::balance() {
+    records.balance();
+}
+
+template<typename T>
+void IndexedTree<T>::setHeightBound(int bound) {
+    records.setHeightBound(bound);
+}
+
+template<typename T>
+const BinaryTree<T>& IndexedTree<T>::tree() const {
+    return records;
+}
+
+template<typename T>
+const StringPool& IndexedTree<T>::pool() const {
+    return strings;
+}
+
+template<typename T>
+std::vector<int> IndexedTree<T>::equal(const std::string& name, int value) const {
+    const Index& index = indexNamed(name);
+    if (index.interned) throw Errors::InvalidArgument("Index " + name + " is on a string field.");
+    return lookup(index, value);
+}
+
+template<typename T>
+std::vector<int> IndexedTree<T>::equal(const std::string& name, std::string_view value) const {
+    const Index& index = indexNamed(name);
+    if (!index.interned) throw Errors::InvalidArgument("Index " + name + " is on an int field.");
+    uint32_t id = strings.find(value);
+    if (id == StringPool::npos) return {};
+    return lookup(index, static_cast<int>(id));
+}
+
+template<typename T>
+std::vector<int> IndexedTree<T>::range(const std::string& name, int lo, int hi) const {
+    const Index& index = indexNamed(name);
+    if (index.interned || index.kind != IndexKind::Ordered) {
+        throw Errors::InvalidArgument("Index " + name + " does not support range queries.");
+    }
+    std::vector<int> keys;
+    if (lo > hi) return keys;
+    for (auto it = index.ordered.lower_bound({ lo, INT_MIN }); it != index.ordered.end() && it->first <= hi; ++it) {
+        keys.push_back(it->second);
+    }
+    return keys;
+}
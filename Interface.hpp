@@ -6,35 +6,15 @@
 #include <complex>
 #include <functional>
 #include "BinaryTree.hpp"
+#include "Generator.hpp"
 #include "User.hpp"
 #include "error.hpp"
 #include <random>
 #include <unordered_set>
+#include <fstream>
 
-BinaryTree<int> RandomTree(int nodes, int depth) {
-    if (nodes > 1001)
-        throw std::runtime_error("Too many nodes: can't generate more than 1001 unique keys in range [0, 1000]");
-
-    BinaryTree<int> rand_tree;
-    std::mt19937 rng(std::random_device{}());
-    std::uniform_int_distribution<int> dist(0, 1000);
-    std::unordered_set<int> unique_keys;
-
-    while (static_cast<int>(unique_keys.size()) < nodes) {
-        unique_keys.insert(dist(rng));
-    }
-
-    std::vector<int> keys(unique_keys.begin(), unique_keys.end());
-    std::shuffle(keys.begin(), keys.end(), rng);
-
-    for (int key : keys) {
-        rand_tree.insert(key, key);
-        if (rand_tree.GetDepth() > depth) {
-            rand_tree.balance();
-        }
-    }
-
-    return rand_tree;
+BinaryTree<int> RandomTree(int nodes, int depth, KeyDistribution dist = KeyDistribution::Uniform, TreeShape shape = TreeShape::Inserted) {
+    return GenerateTree(nodes, dist, shape, depth, std::random_device{}());
 }
 
 
@@ -99,6 +79,9 @@ std::function<double(double)> GetTyped<std::function<double(double)>>(const std:
 struct ITreeWrapper {
     virtual ~ITreeWrapper() = default;
     virtual std::string TypeName() const = 0;
+    virtual std::string ValueTag() const = 0;
+    virtual void Save(std::ostream& os) const = 0;
+    virtual void Load(const std::string& bytes) = 0;
     virtual void Menu(std::vector<ITreeWrapper*>&, std::vector<std::string>&) = 0;
 };
 
@@ -111,13 +94,17 @@ public:
     TreeWrapper(std::string typeName_) : typeName(std::move(typeName_)) {}
 
     std::string TypeName() const override { return typeName; }
+    std::string ValueTag() const override { return Codec<T>::tag; }
+
+    void Save(std::ostream& os) const override { tree.toBinary(os); }
+    void Load(const std::string& bytes) override { tree = BinaryTree<T>::fromBinary(bytes); }
 
     void Menu(std::vector<ITreeWrapper*>& globalTrees, std::vector<std::string>& typeRegistry) override {
         while (true) {
             std::cout << "\n--- Tree Menu (" << typeName << ") ---\n"
                 << "1. Insert\n2. Search\n3. Min\n4. Max\n5. Remove\n"
                 << "6. Traverse (KLP)\n7. Merge with another\n8. Extract Subtree\n"
-                << "9. Balance Tree\n10. Print tree\n11. Serialize\n12. Back\n"
+                << "9. Balance Tree\n10. Print tree\n11. Serialize\n12. Stats\n13. Back\n"
                 << "Choose: ";
             try {
                 int ch = GetInt();
@@ -216,7 +203,15 @@ public:
                     }
                     break;
                 }
-                case 12: return;
+                case 12: {
+                    int format = GetInt("Format (1. Text, 2. JSON): ");
+                    TreeStats stats = tree.stats();
+                    if (format == 1) std::cout << stats.toText() << tree.memoryUsage().toText();
+                    else if (format == 2) std::cout << stats.toJson() << "\n";
+                    else throw Errors::InvalidArgument("Unknown format");
+                    break;
+                }
+                case 13: return;
 
                 default: std::cout << "Invalid option.\n";
                 }
@@ -228,6 +223,97 @@ public:
     }
 };
 
+ITreeWrapper* MakeTreeWrapper(const std::string& valueTag, const std::string& typeName) {
+    if (valueTag == Codec<int>::tag) return new TreeWrapper<int>(typeName);
+    if (valueTag == Codec<double>::tag) return new TreeWrapper<double>(typeName);
+    if (valueTag == Codec<std::string>::tag) return new TreeWrapper<std::string>(typeName);
+    if (valueTag == Codec<std::complex<double>>::tag) return new TreeWrapper<std::complex<double>>(typeName);
+    if (valueTag == Codec<Student>::tag) return new TreeWrapper<Student>(typeName);
+    if (valueTag == Codec<Professor>::tag) return new TreeWrapper<Professor>(typeName);
+    throw Errors::DeserializeFailed();
+}
+
+const std::string SESSION_MAGIC = "BTSESSION1";
+
+// Session file: magic, tree count, then per tree its TypeName(), value tag, payload size and
+// the payload written by BinaryTree::toBinary.
+void SaveSession(const std::string& filename, const std::vector<ITreeWrapper*>& trees) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) throw Errors::FileError(filename);
+
+    std::string header = SESSION_MAGIC;
+    Codecs::WriteVarint(header, trees.size());
+    file.write(header.data(), header.size());
+
+    for (auto* tree : trees) {
+        std::string record;
+        Codecs::WriteBytes(record, tree->TypeName());
+        Codecs::WriteBytes(record, tree->ValueTag());
+        file.write(record.data(), record.size());
+
+        std::streampos sizePos = file.tellp();
+        std::string size;
+        Codecs::WriteU64(size, 0);
+        file.write(size.data(), size.size());
+
+        tree->Save(file);
+
+        std::streampos endPos = file.tellp();
+        size.clear();
+        Codecs::WriteU64(size, static_cast<uint64_t>(endPos - sizePos) - 8);
+        file.seekp(sizePos);
+        file.write(size.data(), size.size());
+        file.seekp(endPos);
+    }
+
+    if (!file) throw Errors::FileError(filename);
+}
+
+void LoadSession(const std::string& filename, std::vector<ITreeWrapper*>& trees, std::vector<std::string>& treeTypes) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) throw Errors::FileError(filename);
+
+    auto readExact = [&](size_t n) {
+        std::string buf(n, '\0');
+        if (!file.read(&buf[0], n)) throw Errors::DeserializeFailed();
+        return buf;
+    };
+    auto readVarint = [&]() {
+        std::string buf;
+        do buf += readExact(1); while (buf.back() & 0x80);
+        size_t pos = 0;
+        return Codecs::ReadVarint(buf, pos);
+    };
+    auto readString = [&]() { return readExact(readVarint()); };
+
+    // A session file is untrusted input: anything malformed, including a tree whose keys are out
+    // of order, rejects the whole file and leaves the open trees as they are.
+    std::vector<ITreeWrapper*> loaded;
+    try {
+        if (readExact(SESSION_MAGIC.size()) != SESSION_MAGIC) throw Errors::DeserializeFailed();
+        uint64_t count = readVarint();
+        for (uint64_t i = 0; i < count; ++i) {
+            std::string typeName = readString();
+            std::string valueTag = readString();
+            std::string size = readExact(8);
+            size_t pos = 0;
+            std::string payload = readExact(Codecs::ReadU64(size, pos));
+
+            loaded.push_back(MakeTreeWrapper(valueTag, typeName));
+            loaded.back()->Load(payload);
+        }
+    }
+    catch (const std::exception& e) {
+        for (auto* ptr : loaded) delete ptr;
+        throw Errors::FileError(filename + " (" + e.what() + ")");
+    }
+
+    for (auto* ptr : trees) delete ptr;
+    trees = loaded;
+    treeTypes.clear();
+    for (auto* ptr : trees) treeTypes.push_back(ptr->TypeName());
+}
+
 void ShowTypeMenu() {
     std::cout << "Choose data type:\n"
         << "1. int\n2. double\n3. string\n4. complex\n"
@@ -240,7 +326,7 @@ void Run() {
 
     while (true) {
         std::cout << "\n=== Main Menu ===\n"
-            << "1. Add Tree\n2. List Trees\n3. Work With Tree\n4. Delete Tree\n5. Random tree\n6. String to tree\n7. Recovery tree by two traverses\n8. Exit\nChoose: ";
+            << "1. Add Tree\n2. List Trees\n3. Work With Tree\n4. Delete Tree\n5. Random tree\n6. String to tree\n7. Recovery tree by two traverses\n8. Save session\n9. Load session\n10. Exit\nChoose: ";
         try {
             int ch = GetInt();
             switch (ch) {
@@ -303,7 +389,12 @@ void Run() {
                 int nodes = GetInt("Number of nodes: ");
                 int depth = GetInt("Max depth: ");
                 if (nodes <= 0 || depth <= 0) throw Errors::InvalidArgument("Nodes and depth must be positive.");
-                BinaryTree<int> rand_tree = RandomTree(nodes, depth);
+                int dist = GetInt("Key distribution (1. uniform 2. sorted 3. reverse 4. zipfian 5. clustered 6. adversarial): ");
+                if (dist < 1 || dist > 6) throw Errors::InvalidArgument("Unknown distribution.");
+                int shape = GetInt("Shape (1. insertion order 2. balanced): ");
+                if (shape < 1 || shape > 2) throw Errors::InvalidArgument("Unknown shape.");
+                BinaryTree<int> rand_tree = RandomTree(nodes, depth, static_cast<KeyDistribution>(dist - 1),
+                    shape == 1 ? TreeShape::Inserted : TreeShape::Balanced);
                 auto* wrapper = new TreeWrapper<int>("RandomTree");
                 wrapper->tree = std::move(rand_tree);
                 trees.push_back(wrapper);
@@ -385,18 +476,31 @@ void Run() {
                 break;
             }
             case 7: {
+                int mode = GetInt("1. KLP + LKP\n2. KLP only (BST)\n3. LPK only (BST)\nChoose: ");
                 std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 
-                std::cout << "Enter KLP traverse (format: value value value): ";
-                std::string traverseKLP;
-                std::getline(std::cin, traverseKLP);
+                try {
+                    BinaryTree<int> tree;
+                    if (mode == 1) {
+                        std::cout << "Enter KLP traverse (format: value value value): ";
+                        std::string traverseKLP;
+                        std::getline(std::cin, traverseKLP);
 
-                std::cout << "Enter LKP traverse (format: value value value): ";
-                std::string traverseLKP;
-                std::getline(std::cin, traverseLKP);
+                        std::cout << "Enter LKP traverse (format: value value value): ";
+                        std::string traverseLKP;
+                        std::getline(std::cin, traverseLKP);
+
+                        tree = BinaryTree<int>::recoveryTree(traverseKLP, traverseLKP);
+                    }
+                    else if (mode == 2 || mode == 3) {
+                        std::cout << "Enter " << (mode == 2 ? "KLP" : "LPK") << " traverse (format: value value value): ";
+                        std::string traverse;
+                        std::getline(std::cin, traverse);
+
+                        tree = mode == 2 ? BinaryTree<int>::recoveryFromKLP(traverse) : BinaryTree<int>::recoveryFromLPK(traverse);
+                    }
+                    else throw Errors::InvalidArgument();
 
-                try {
-                    auto tree = BinaryTree<int>::recoveryTree(traverseKLP, traverseLKP);
                     auto* wrapper = new TreeWrapper<int>("int");
                     wrapper->tree = std::move(tree);
                     trees.push_back(wrapper);
@@ -408,6 +512,22 @@ void Run() {
                 break;
             }
             case 8: {
+                std::cout << "File name: ";
+                std::string filename;
+                std::cin >> filename;
+                SaveSession(filename, trees);
+                std::cout << "Session saved: " << trees.size() << " trees.\n";
+                break;
+            }
+            case 9: {
+                std::cout << "File name: ";
+                std::string filename;
+                std::cin >> filename;
+                LoadSession(filename, trees, treeTypes);
+                std::cout << "Session loaded: " << trees.size() << " trees.\n";
+                break;
+            }
+            case 10: {
                 for (auto* ptr : trees) delete ptr;
                 std::cout << "Exiting...\n";
                 return;
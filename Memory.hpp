@@ -0,0 +1,87 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <algorithm>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace Memory {
+
+    // Block size malloc hands out for `request` bytes, modelled on glibc: an 8-byte header,
+    // 16-byte granularity and 32 bytes minimum. Other allocators differ by a few bytes.
+    inline size_t AllocatedSize(size_t request) {
+        return std::max<size_t>(32, (request + 8 + 15) & ~size_t(15));
+    }
+
+    inline size_t Slack(size_t request) {
+        return AllocatedSize(request) - request;
+    }
+
+    // Peak resident set size of the process in bytes (ru_maxrss is in kilobytes on Linux);
+    // 0 where getrusage is not available.
+    inline size_t PeakRss() {
+#ifndef _WIN32
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+        return 0;
+    }
+}
+
+struct HeapUsage {
+    size_t bytes = 0;
+    size_t slack = 0;
+
+    void add(size_t request) {
+        bytes += request;
+        slack += Memory::Slack(request);
+    }
+};
+
+// HeapBytes<T> adds every heap block a value owns to a HeapUsage. The default owns nothing;
+// specialize it for types that hold strings, vectors and the like.
+template<typename T>
+struct HeapBytes {
+    void operator()(const T&, HeapUsage&) const {}
+};
+
+template<>
+struct HeapBytes<std::string> {
+    void operator()(const std::string& s, HeapUsage& usage) const {
+        // Short strings live inside the object itself.
+        const char* self = reinterpret_cast<const char*>(&s);
+        if (s.data() >= self && s.data() < self + sizeof(s)) return;
+        usage.add(s.capacity() + 1);
+    }
+};
+
+struct MemoryUsage {
+    size_t nodes = 0;
+    size_t nodeOverhead = 0;     // keys, links, cached fields and padding
+    size_t valuePayload = 0;     // sizeof(T) per node
+    size_t valueHeap = 0;        // heap blocks owned by the keys and values
+    size_t allocatorSlack = 0;   // malloc headers and rounding of node and value blocks
+    size_t indexBytes = 0;       // subtree hash index and value index
+
+    size_t total() const {
+        return nodeOverhead + valuePayload + valueHeap + allocatorSlack + indexBytes;
+    }
+
+    double bytesPerElement() const {
+        return nodes ? static_cast<double>(total()) / nodes : 0;
+    }
+
+    std::string toText() const {
+        std::string out;
+        out += "nodes: " + std::to_string(nodes) + "\n";
+        out += "node overhead: " + std::to_string(nodeOverhead) + " bytes\n";
+        out += "value payload: " + std::to_string(valuePayload) + " bytes\n";
+        out += "value heap: " + std::to_string(valueHeap) + " bytes\n";
+        out += "allocator slack: " + std::to_string(allocatorSlack) + " bytes\n";
+        out += "indexes: " + std::to_string(indexBytes) + " bytes\n";
+        out += "total: " + std::to_string(total()) + " bytes (" + std::to_string(bytesPerElement()) + " per element)\n";
+        return out;
+    }
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+// Instrumentation of BinaryTree. Everything here is compiled out unless BINARYTREE_STATS is
+// defined before the first include of BinaryTree.hpp (or passed with -DBINARYTREE_STATS);
+// stats() then returns an empty snapshot with enabled == false.
+#ifdef BINARYTREE_STATS
+#define TREE_STAT(...) __VA_ARGS__
+#else
+#define TREE_STAT(...)
+#endif
+
+// Latencies in power-of-two buckets: bucket i counts samples in [2^(i-1), 2^i) ns.
+struct LatencyHistogram {
+    static const int BUCKETS = 40;
+    uint64_t buckets[BUCKETS] = {};
+    uint64_t count = 0;
+    uint64_t totalNs = 0;
+
+    void record(uint64_t ns) {
+        int b = 0;
+        while (b < BUCKETS - 1 && (uint64_t(1) << b) <= ns) ++b;
+        ++buckets[b];
+        ++count;
+        totalNs += ns;
+    }
+
+    // Upper bound of the bucket that holds the p-th sample.
+    uint64_t percentile(double p) const {
+        if (count == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(p * (count - 1)) + 1, seen = 0;
+        for (int b = 0; b < BUCKETS; ++b) {
+            seen += buckets[b];
+            if (seen >= rank) return uint64_t(1) << b;
+        }
+        return uint64_t(1) << (BUCKETS - 1);
+    }
+
+    double mean() const { return count ? static_cast<double>(totalNs) / count : 0; }
+};
+
+struct TreeStats {
+    bool enabled = false;
+    uint64_t comparisons = 0;       // key comparisons on search/insert/remove paths
+    uint64_t nodesVisited = 0;      // nodes touched by any operation, traversals included
+    uint64_t allocations = 0;
+    uint64_t frees = 0;
+    uint64_t rebalances = 0;        // subtree rebuilds, by balance() or the height bound
+    uint64_t bytesParsed = 0;
+    uint64_t bytesSerialized = 0;
+    uint64_t hotHits = 0;           // searches answered by the hot-key cache
+    uint64_t filterRejects = 0;     // searches the key filter answered as absent
+    uint64_t filterFalsePositives = 0;  // searches it let through that found no key
+    LatencyHistogram insertLatency;
+    LatencyHistogram searchLatency;
+    LatencyHistogram removeLatency;
+
+    // Share of searches for absent keys that the key filter let through.
+    double filterFalsePositiveRate() const {
+        uint64_t absent = filterRejects + filterFalsePositives;
+        return absent ? static_cast<double>(filterFalsePositives) / absent : 0;
+    }
+
+    std::string toText() const {
+        if (!enabled) return "Statistics are disabled (build with -DBINARYTREE_STATS).\n";
+        std::string out;
+        out += "comparisons: " + std::to_string(comparisons) + "\n";
+        out += "nodes visited: " + std::to_string(nodesVisited) + "\n";
+        out += "allocations: " + std::to_string(allocations) + "\n";
+        out += "frees: " + std::to_string(frees) + "\n";
+        out += "rebalances: " + std::to_string(rebalances) + "\n";
+        out += "bytes parsed: " + std::to_string(bytesParsed) + "\n";
+        out += "bytes serialized: " + std::to_string(bytesSerialized) + "\n";
+        out += "hot cache hits: " + std::to_string(hotHits) + "\n";
+        out += "key filter: " + std::to_string(filterRejects) + " rejected, " + std::to_string(filterFalsePositives)
+            + " false positives (rate " + std::to_string(filterFalsePositiveRate()) + ")\n";
+        out += latencyText("insert", insertLatency);
+        out += latencyText("search", searchLatency);
+        out += latencyText("remove", removeLatency);
+        return out;
+    }
+
+    std::string toJson() const {
+        std::string out = "{\"enabled\": " + std::string(enabled ? "true" : "false");
+        out += ", \"comparisons\": " + std::to_string(comparisons);
+        out += ", \"nodes_visited\": " + std::to_string(nodesVisited);
+        out += ", \"allocations\": " + std::to_string(allocations);
+        out += ", \"frees\": " + std::to_string(frees);
+        out += ", \"rebalances\": " + std::to_string(rebalances);
+        out += ", \"bytes_parsed\": " + std::to_string(bytesParsed);
+        out += ", \"bytes_serialized\": " + std::to_string(bytesSerialized);
+        out += ", \"hot_hits\": " + std::to_string(hotHits);
+        out += ", \"filter_rejects\": " + std::to_string(filterRejects);
+        out += ", \"filter_false_positives\": " + std::to_string(filterFalsePositives);
+        out += ", \"filter_false_positive_rate\": " + std::to_string(filterFalsePositiveRate());
+        out += ", \"insert\": " + latencyJson(insertLatency);
+        out += ", \"search\": " + latencyJson(searchLatency);
+        out += ", \"remove\": " + latencyJson(removeLatency);
+        out += "}";
+        return out;
+    }
+
+private:
+    static std::string latencyText(const std::string& name, const LatencyHistogram& h) {
+        return name + " latency: " + std::to_string(h.count) + " ops, mean " + std::to_string(static_cast<uint64_t>(h.mean()))
+            + " ns, p50 <= " + std::to_string(h.percentile(0.5)) + " ns, p99 <= " + std::to_string(h.percentile(0.99)) + " ns\n";
+    }
+
+    static std::string latencyJson(const LatencyHistogram& h) {
+        std::string out = "{\"count\": " + std::to_string(h.count) + ", \"mean_ns\": " + std::to_string(h.mean())
+            + ", \"p50_ns\": " + std::to_string(h.percentile(0.5)) + ", \"p99_ns\": " + std::to_string(h.percentile(0.99))
+            + ", \"buckets\": [";
+        for (int b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+            if (b) out += ", ";
+            out += std::to_string(h.buckets[b]);
+        }
+        return out + "]}";
+    }
+};
+
+// Adds the lifetime of the scope to a histogram.
+class StatsTimer {
+private:
+    LatencyHistogram& histogram;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit StatsTimer(LatencyHistogram& h) : histogram(h), start(std::chrono::steady_clock::now()) {}
+    ~StatsTimer() {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        histogram.record(static_cast<uint64_t>(ns));
+    }
+};
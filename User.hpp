@@ -2,6 +2,8 @@
 
 #include <iostream>
 #include <string>
+#include "Codec.hpp"
+#include "Memory.hpp"
 
 
 struct User {
@@ -116,4 +118,163 @@ struct Professor : public User {
 
         return is;
     }
+};
+
+
+template<>
+struct Codec<User> {
+    static constexpr const char* tag = "User";
+
+    static void writeBinary(std::string& out, const User& u) {
+        Codec<std::string>::writeBinary(out, u.name);
+        Codec<int>::writeBinary(out, u.age);
+        Codec<int>::writeBinary(out, u.id);
+    }
+    static User readBinary(const std::string& in, size_t& pos) {
+        User u;
+        u.name = Codec<std::string>::readBinary(in, pos);
+        u.age = Codec<int>::readBinary(in, pos);
+        u.id = Codec<int>::readBinary(in, pos);
+        return u;
+    }
+
+    static void writeText(std::string& out, const User& u) {
+        Codec<std::string>::writeText(out, u.name);
+        out += ',';
+        Codec<int>::writeText(out, u.age);
+        out += ',';
+        Codec<int>::writeText(out, u.id);
+    }
+    static User readText(const std::string& in, size_t& pos) {
+        User u;
+        u.name = Codec<std::string>::readText(in, pos);
+        Codecs::Expect(in, pos, ',');
+        u.age = Codec<int>::readText(in, pos);
+        Codecs::Expect(in, pos, ',');
+        u.id = Codec<int>::readText(in, pos);
+        return u;
+    }
+};
+
+template<>
+struct Codec<Student> {
+    static constexpr const char* tag = "Student";
+
+    static void writeBinary(std::string& out, const Student& s) {
+        Codec<User>::writeBinary(out, s);
+        Codec<std::string>::writeBinary(out, s.group);
+        Codec<bool>::writeBinary(out, s.exam_pass);
+    }
+    static Student readBinary(const std::string& in, size_t& pos) {
+        Student s;
+        static_cast<User&>(s) = Codec<User>::readBinary(in, pos);
+        s.group = Codec<std::string>::readBinary(in, pos);
+        s.exam_pass = Codec<bool>::readBinary(in, pos);
+        return s;
+    }
+
+    static void writeText(std::string& out, const Student& s) {
+        Codec<User>::writeText(out, s);
+        out += ',';
+        Codec<std::string>::writeText(out, s.group);
+        out += ',';
+        Codec<bool>::writeText(out, s.exam_pass);
+    }
+    static Student readText(const std::string& in, size_t& pos) {
+        Student s;
+        static_cast<User&>(s) = Codec<User>::readText(in, pos);
+        Codecs::Expect(in, pos, ',');
+        s.group = Codec<std::string>::readText(in, pos);
+        Codecs::Expect(in, pos, ',');
+        s.exam_pass = Codec<bool>::readText(in, pos);
+        return s;
+    }
+};
+
+template<>
+struct Codec<Professor> {
+    static constexpr const char* tag = "Professor";
+
+    static void writeBinary(std::string& out, const Professor& p) {
+        Codec<User>::writeBinary(out, p);
+        Codec<std::string>::writeBinary(out, p.subject);
+        Codec<bool>::writeBinary(out, p.be_on_exam);
+    }
+    static Professor readBinary(const std::string& in, size_t& pos) {
+        Professor p;
+        static_cast<User&>(p) = Codec<User>::readBinary(in, pos);
+        p.subject = Codec<std::string>::readBinary(in, pos);
+        p.be_on_exam = Codec<bool>::readBinary(in, pos);
+        return p;
+    }
+
+    static void writeText(std::string& out, const Professor& p) {
+        Codec<User>::writeText(out, p);
+        out += ',';
+        Codec<std::string>::writeText(out, p.subject);
+        out += ',';
+        Codec<bool>::writeText(out, p.be_on_exam);
+    }
+    static Professor readText(const std::string& in, size_t& pos) {
+        Professor p;
+        static_cast<User&>(p) = Codec<User>::readText(in, pos);
+        Codecs::Expect(in, pos, ',');
+        p.subject = Codec<std::string>::readText(in, pos);
+        Codecs::Expect(in, pos, ',');
+        p.be_on_exam = Codec<bool>::readText(in, pos);
+        return p;
+    }
+};
+
+
+
+template<>
+struct HeapBytes<User> {
+    void operator()(const User& u, HeapUsage& usage) const {
+        HeapBytes<std::string>{}(u.name, usage);
+    }
+};
+
+template<>
+struct HeapBytes<Student> {
+    void operator()(const Student& s, HeapUsage& usage) const {
+        HeapBytes<User>{}(s, usage);
+        HeapBytes<std::string>{}(s.group, usage);
+    }
+};
+
+template<>
+struct HeapBytes<Professor> {
+    void operator()(const Professor& p, HeapUsage& usage) const {
+        HeapBytes<User>{}(p, usage);
+        HeapBytes<std::string>{}(p.subject, usage);
+    }
+};
+
+
+
+// Field-wise hashes, so hashing a record never builds its encoding.
+template<>
+struct ValueHash<User> {
+    size_t operator()(const User& u) const {
+        uint64_t h = Codecs::HashMix(std::hash<std::string>{}(u.name));
+        h = Codecs::HashMix(h ^ static_cast<uint32_t>(u.age));
+        return Codecs::HashMix(h ^ (static_cast<uint64_t>(static_cast<uint32_t>(u.id)) << 32));
+    }
+};
+
+template<>
+struct ValueHash<Student> {
+    size_t operator()(const Student& s) const {
+        uint64_t h = Codecs::HashMix(ValueHash<User>{}(s) ^ std::hash<std::string>{}(s.group));
+        return Codecs::HashMix(h ^ (s.exam_pass ? 1 : 0));
+    }
+};
+
+template<>
+struct ValueHash<Professor> {
+    size_t operator()(const Professor& p) const {
+        uint64_t h = Codecs::HashMix(ValueHash<User>{}(p) ^ std::hash<std::string>{}(p.subject));
+        return Codecs::HashMix(h ^ (p.be_on_exam ? 1 : 0));
+    }
 };
\ No newline at end of file
@@ -0,0 +1,488 @@
+#include "Benchmark.hpp"
+#include "Generator.hpp"
+#include "CompactTree.hpp"
+#include "User.hpp"
+#include "Columnar.hpp"
+#include "IndexedTree.hpp"
+
+#include <sstream>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Usage: bench [--sizes 1000,10000] [--dists uniform,zipfian] [--reps 5] [--warmups 1] [--out bench_results]
+//              [--suite all|tree|baseline|records]
+// Writes <out>.csv and <out>.json.
+
+const uint64_t SEED = 20240501;
+const size_t POINT_OPS = 10000;
+const size_t SCAN_OPS = 1000;
+const size_t SCAN_WIDTH = 64;
+const size_t MAX_VECTOR_INSERTS = 100000;
+
+
+// Live heap bytes, counted by replacing the global allocation functions. Every block carries
+// its requested size in a 16-byte header, so allocator slack is not included. The functions are
+// kept out of line, otherwise GCC sees free() on a pointer from new and warns.
+std::atomic<size_t> liveBytes{ 0 };
+
+__attribute__((noinline)) void* operator new(size_t n) {
+    void* p = std::malloc(n + 16);
+    if (!p) throw std::bad_alloc();
+    *static_cast<size_t*>(p) = n;
+    liveBytes += n;
+    return static_cast<char*>(p) + 16;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    if (!p) return;
+    char* block = static_cast<char*>(p) - 16;
+    liveBytes -= *reinterpret_cast<size_t*>(block);
+    std::free(block);
+}
+
+void* operator new[](size_t n) { return operator new(n); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+struct Options {
+    std::vector<size_t> sizes{ 1000, 10000, 100000 };
+    std::vector<KeyDistribution> dists{ KeyDistribution::Uniform, KeyDistribution::Sorted, KeyDistribution::Reverse,
+        KeyDistribution::Zipfian, KeyDistribution::Clustered, KeyDistribution::Adversarial };
+    int reps = 5;
+    int warmups = 1;
+    std::string out = "bench_results";
+    std::string suite = "all";
+};
+
+std::vector<std::string> SplitList(const std::string& s) {
+    std::vector<std::string> parts;
+    std::istringstream iss(s);
+    std::string part;
+    while (std::getline(iss, part, ',')) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+Options ParseOptions(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) throw Errors::InvalidArgument("Missing value for " + arg);
+        std::string value = argv[++i];
+
+        if (arg == "--sizes") {
+            opt.sizes.clear();
+            for (const auto& s : SplitList(value)) opt.sizes.push_back(std::stoull(s));
+        }
+        else if (arg == "--dists") {
+            opt.dists.clear();
+            for (const auto& s : SplitList(value)) opt.dists.push_back(ParseDistribution(s));
+        }
+        else if (arg == "--reps") opt.reps = std::stoi(value);
+        else if (arg == "--warmups") opt.warmups = std::stoi(value);
+        else if (arg == "--out") opt.out = value;
+        else if (arg == "--suite") {
+            if (value != "all" && value != "tree" && value != "baseline" && value != "records") throw Errors::InvalidArgument("Unknown suite: " + value);
+            opt.suite = value;
+        }
+        else throw Errors::InvalidArgument("Unknown option: " + arg);
+    }
+    return opt;
+}
+
+// Plain inserts degenerate into a path on ordered inputs, so trees are built under a height
+// bound of twice the optimal height, as a production tree would be.
+int BenchBound(size_t n) {
+    int h = 1;
+    for (size_t m = n; m > 0; m >>= 1) ++h;
+    return 2 * h;
+}
+
+// Keys that are not in the (sorted) key set, spread over the same range.
+std::vector<int> MissKeys(const std::vector<int>& sorted, size_t count, uint64_t seed) {
+    std::vector<int> misses;
+    int64_t lo = sorted.front(), hi = static_cast<int64_t>(sorted.back()) + static_cast<int64_t>(sorted.size());
+    for (uint64_t i = 0; misses.size() < count; ++i) {
+        int64_t key = lo + static_cast<int64_t>(RandomAt(seed, i) % static_cast<uint64_t>(hi - lo + 1));
+        if (key > INT_MAX) continue;
+        if (!std::binary_search(sorted.begin(), sorted.end(), static_cast<int>(key))) misses.push_back(static_cast<int>(key));
+    }
+    return misses;
+}
+
+std::string Join(const std::vector<int>& keys) {
+    std::string out;
+    for (int key : keys) {
+        Codecs::WriteNumber(out, key);
+        out += ' ';
+    }
+    return out;
+}
+
+void RunSuite(BenchSuite& suite, size_t n, KeyDistribution dist) {
+    if (n == 0) return;
+    const std::string name = DistributionName(dist);
+    const int bound = BenchBound(n);
+
+    std::vector<int> order = GenerateKeys(n, dist, SEED);
+    std::vector<int> sorted = order;
+    std::sort(sorted.begin(), sorted.end());
+
+    BinaryTree<int> base;
+    base.setHeightBound(bound);
+    for (int key : order) base.insert(key, key);
+
+    size_t ops = std::min(n, POINT_OPS);
+    std::vector<int> hits = GenerateAccesses(sorted, ops, dist, SEED);
+    std::vector<int> misses = MissKeys(sorted, ops, SEED);
+
+    suite.Point("insert", name, n, n,
+        [&]() { BinaryTree<int> t; t.setHeightBound(bound); return t; },
+        [&](BinaryTree<int>& t, size_t i) { t.insert(order[i], order[i]); });
+
+    if (dist == KeyDistribution::Uniform || dist == KeyDistribution::Zipfian) {
+        suite.Point("insert_unbounded", name, n, n,
+            [&]() { return BinaryTree<int>(); },
+            [&](BinaryTree<int>& t, size_t i) { t.insert(order[i], order[i]); });
+    }
+
+    suite.Point("remove", name, n, ops,
+        [&]() { return BinaryTree<int>(base); },
+        [&](BinaryTree<int>& t, size_t i) { t.remove(order[i]); });
+    suite.Point("remove_lazy", name, n, ops,
+        [&]() { BinaryTree<int> t(base); t.setTombstoneRatio(0.25); return t; },
+        [&](BinaryTree<int>& t, size_t i) { t.remove(order[i]); });
+
+    // Drop the lower half of the keys: one removeRange against a remove() per key.
+    const int cutoff = sorted[n / 2];
+    suite.Bulk("removeRange", name, n, [&]() { return BinaryTree<int>(base); },
+        [&](BinaryTree<int>& t) { t.removeRange(sorted.front(), cutoff); });
+    suite.Bulk("removeRange_per_key", name, n, [&]() { return BinaryTree<int>(base); },
+        [&](BinaryTree<int>& t) { for (size_t i = 0; i <= n / 2; ++i) t.remove(sorted[i]); });
+    suite.Bulk("removeIf", name, n, [&]() { return BinaryTree<int>(base); },
+        [&](BinaryTree<int>& t) { t.removeIf([](const int& v) { return v % 2 != 0; }); });
+
+    volatile int sink = 0;
+    suite.Point("search_hit", name, n, ops,
+        [&]() { return &base; },
+        [&](BinaryTree<int>* t, size_t i) { sink = sink + *t->search(hits[i]); });
+
+    // The same lookups through a 1024-slot hot-key cache; pays off when the accesses are skewed.
+    BinaryTree<int> hot(base);
+    hot.enableHotCache();
+    suite.Point("search_hit_hot", name, n, ops,
+        [&]() { return &hot; },
+        [&](BinaryTree<int>* t, size_t i) { sink = sink + *t->search(hits[i]); });
+
+    suite.Point("search_miss", name, n, ops,
+        [&]() { return &base; },
+        [&](BinaryTree<int>* t, size_t i) { sink = sink + (t->search(misses[i]) != nullptr); });
+
+    // Misses and hits again with a 10 bits/key filter in front of the walk.
+    BinaryTree<int> filtered(base);
+    filtered.enableKeyFilter();
+    suite.Point("search_miss_filtered", name, n, ops,
+        [&]() { return &filtered; },
+        [&](BinaryTree<int>* t, size_t i) { sink = sink + (t->search(misses[i]) != nullptr); });
+    suite.Point("search_hit_filtered", name, n, ops,
+        [&]() { return &filtered; },
+        [&](BinaryTree<int>* t, size_t i) { sink = sink + *t->search(hits[i]); });
+
+    auto count = [&](const int&) { sink = sink + 1; };
+    suite.Bulk("traverse_KLP", name, n, [&]() { return &base; }, [&](BinaryTree<int>* t) { t->traverseKLP(count); });
+    suite.Bulk("traverse_KPL", name, n, [&]() { return &base; }, [&](BinaryTree<int>* t) { t->traverseKPL(count); });
+    suite.Bulk("traverse_LPK", name, n, [&]() { return &base; }, [&](BinaryTree<int>* t) { t->traverseLPK(count); });
+    suite.Bulk("traverse_LKP", name, n, [&]() { return &base; }, [&](BinaryTree<int>* t) { t->traverseLKP(count); });
+    suite.Bulk("traverse_PLK", name, n, [&]() { return &base; }, [&](BinaryTree<int>* t) { t->traversePLK(count); });
+    suite.Bulk("traverse_PKL", name, n, [&]() { return &base; }, [&](BinaryTree<int>* t) { t->traversePKL(count); });
+
+    // The second tree shares half of the keys with the first one.
+    BinaryTree<int> other;
+    other.setHeightBound(bound);
+    for (size_t i = 0; i < n; ++i) {
+        int key = i % 2 ? sorted[i] : sorted[i] + 1;
+        other.insert(key, key);
+    }
+    suite.Bulk("merge", name, 2 * n, [&]() { return &base; }, [&](BinaryTree<int>* t) { t->merge(other); });
+
+    suite.Bulk("balance", name, n, [&]() { return BinaryTree<int>(base); }, [&](BinaryTree<int>& t) { t.balance(); });
+
+    // Left child of the root, so the copied subtree is a sizeable part of the tree.
+    if (const int* left = base.findByPath("L")) {
+        int key = *left;
+        suite.Bulk("extractSubtree", name, n, [&]() { return &base; }, [&](BinaryTree<int>* t) { t->extractSubtree(key); });
+    }
+
+    std::string text = base.toString();
+    std::ostringstream binaryStream;
+    base.toBinary(binaryStream);
+    std::string binary = binaryStream.str();
+
+    suite.Bulk("toString", name, n, [&]() { return &base; }, [&](BinaryTree<int>* t) { sink = sink + static_cast<int>(t->toString().size()); });
+    suite.Bulk("fromString", name, n, [&]() { return &text; }, [&](std::string* s) { BinaryTree<int>::fromString(*s); });
+    suite.Bulk("toBinary", name, n, [&]() { return &base; },
+        [&](BinaryTree<int>* t) { std::ostringstream os; t->toBinary(os); sink = sink + static_cast<int>(os.tellp()); });
+    suite.Bulk("fromBinary", name, n, [&]() { return &binary; }, [&](std::string* s) { BinaryTree<int>::fromBinary(*s); });
+
+    std::vector<int> klp, lpk;
+    base.traverseKLP([&](const int& v) { klp.push_back(v); });
+    base.traverseLPK([&](const int& v) { lpk.push_back(v); });
+    std::string klpText = Join(klp), lkpText = Join(sorted), lpkText = Join(lpk);
+
+    suite.Bulk("recovery_KLP_LKP", name, n, [&]() { return 0; }, [&](int) { BinaryTree<int>::recoveryTree(klpText, lkpText); });
+    suite.Bulk("recovery_KLP", name, n, [&]() { return 0; }, [&](int) { BinaryTree<int>::recoveryFromKLP(klpText); });
+    suite.Bulk("recovery_LPK", name, n, [&]() { return 0; }, [&](int) { BinaryTree<int>::recoveryFromLPK(lpkText); });
+}
+
+// The same workloads run against BinaryTree and the usual alternatives. Each engine is built
+// either empty or from sorted keys and stores key == value.
+struct TreeEngine {
+    static constexpr const char* name = "BinaryTree";
+    static constexpr bool quadraticInsert = false;
+    BinaryTree<int> tree;
+
+    explicit TreeEngine(int bound) { tree.setHeightBound(bound); }
+    TreeEngine(const std::vector<int>& sorted, int bound) : tree(BinaryTree<int>::fromSorted(sorted, sorted)) { tree.setHeightBound(bound); }
+
+    void insert(int key) { tree.insert(key, key); }
+    bool find(int key) const { return tree.search(key) != nullptr; }
+    void erase(int key) { tree.remove(key); }
+    long long scan(int lo, int hi) const {
+        long long sum = 0;
+        tree.traverseRange(lo, hi, [&](int, const int& v) { sum += v; });
+        return sum;
+    }
+};
+
+// No height bound, so ordered inserts degrade to O(n) each like the sorted vector.
+struct CompactEngine {
+    static constexpr const char* name = "CompactBinaryTree";
+    static constexpr bool quadraticInsert = true;
+    CompactBinaryTree<int> tree;
+
+    explicit CompactEngine(int) {}
+    CompactEngine(const std::vector<int>& sorted, int) {
+        BinaryTree<int> source = BinaryTree<int>::fromSorted(sorted, sorted);
+        tree = CompactBinaryTree<int>::fromTree(source);
+    }
+
+    void insert(int key) { tree.insert(key, key); }
+    bool find(int key) const { return tree.search(key) != nullptr; }
+    void erase(int key) { tree.remove(key); }
+    long long scan(int lo, int hi) const {
+        long long sum = 0;
+        tree.traverseRange(lo, hi, [&](int, const int& v) { sum += v; });
+        return sum;
+    }
+};
+
+struct MapEngine {
+    static constexpr const char* name = "std::map";
+    static constexpr bool quadraticInsert = false;
+    std::map<int, int> map;
+
+    explicit MapEngine(int) {}
+    MapEngine(const std::vector<int>& sorted, int) {
+        for (int key : sorted) map.emplace_hint(map.end(), key, key);
+    }
+
+    void insert(int key) { map[key] = key; }
+    bool find(int key) const { return map.find(key) != map.end(); }
+    void erase(int key) { map.erase(key); }
+    long long scan(int lo, int hi) const {
+        long long sum = 0;
+        for (auto it = map.lower_bound(lo); it != map.end() && it->first <= hi; ++it) sum += it->second;
+        return sum;
+    }
+};
+
+struct VectorEngine {
+    static constexpr const char* name = "sorted_vector";
+    static constexpr bool quadraticInsert = true;
+    std::vector<std::pair<int, int>> items;
+
+    explicit VectorEngine(int) {}
+    VectorEngine(const std::vector<int>& sorted, int) {
+        items.reserve(sorted.size());
+        for (int key : sorted) items.push_back({ key, key });
+    }
+
+    std::vector<std::pair<int, int>>::const_iterator lowerBound(int key) const {
+        return std::lower_bound(items.begin(), items.end(), key, [](const std::pair<int, int>& item, int k) { return item.first < k; });
+    }
+
+    void insert(int key) {
+        auto it = lowerBound(key);
+        if (it != items.end() && it->first == key) return;
+        items.insert(it, { key, key });
+    }
+    bool find(int key) const {
+        auto it = lowerBound(key);
+        return it != items.end() && it->first == key;
+    }
+    void erase(int key) {
+        auto it = lowerBound(key);
+        if (it != items.end() && it->first == key) items.erase(it);
+    }
+    long long scan(int lo, int hi) const {
+        long long sum = 0;
+        for (auto it = lowerBound(lo); it != items.end() && it->first <= hi; ++it) sum += it->second;
+        return sum;
+    }
+};
+
+template<typename Engine>
+void RunBaseline(BenchSuite& suite, const std::string& dist, const std::vector<int>& order, const std::vector<int>& sorted,
+    const std::vector<int>& hits, const std::vector<size_t>& scans) {
+    const size_t n = sorted.size();
+    const size_t ops = hits.size();
+    const int bound = BenchBound(n);
+    volatile long long sink = 0;
+
+    suite.SetEngine(Engine::name);
+
+    {
+        size_t before = liveBytes;
+        auto engine = std::make_unique<Engine>(sorted, bound);
+        suite.Memory(dist, n, liveBytes - before);
+    }
+
+    suite.Bulk("cmp_bulk_load", dist, n, [&]() { return std::unique_ptr<Engine>(); },
+        [&](std::unique_ptr<Engine>& e) { e = std::make_unique<Engine>(sorted, bound); });
+
+    // Inserting into a sorted vector is O(n) per key; larger runs would only measure memmove.
+    if (!Engine::quadraticInsert || n <= MAX_VECTOR_INSERTS) {
+        suite.Point("cmp_insert", dist, n, n, [&]() { return std::make_unique<Engine>(bound); },
+            [&](std::unique_ptr<Engine>& e, size_t i) { e->insert(order[i]); });
+    }
+
+    Engine loaded(sorted, bound);
+    suite.Point("cmp_lookup", dist, n, ops, [&]() { return &loaded; },
+        [&](Engine* e, size_t i) { sink = sink + e->find(hits[i]); });
+
+    suite.Point("cmp_range_scan", dist, n, scans.size(), [&]() { return &loaded; },
+        [&](Engine* e, size_t i) {
+            size_t j = scans[i];
+            sink = sink + e->scan(sorted[j], sorted[std::min(n - 1, j + SCAN_WIDTH - 1)]);
+        });
+
+    suite.Point("cmp_delete", dist, n, ops, [&]() { return std::make_unique<Engine>(sorted, bound); },
+        [&](std::unique_ptr<Engine>& e, size_t i) { e->erase(order[i]); });
+
+    suite.SetEngine("BinaryTree");
+}
+
+void RunBaselines(BenchSuite& suite, size_t n, KeyDistribution dist) {
+    if (n == 0) return;
+    const std::string name = DistributionName(dist);
+
+    std::vector<int> order = GenerateKeys(n, dist, SEED);
+    std::vector<int> sorted = order;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<int> hits = GenerateAccesses(sorted, std::min(n, POINT_OPS), dist, SEED);
+
+    std::vector<size_t> scans(SCAN_OPS);
+    for (size_t i = 0; i < scans.size(); ++i) scans[i] = RandomAt(SEED + 1, i) % n;
+
+    RunBaseline<TreeEngine>(suite, name, order, sorted, hits, scans);
+    RunBaseline<CompactEngine>(suite, name, order, sorted, hits, scans);
+    RunBaseline<MapEngine>(suite, name, order, sorted, hits, scans);
+    RunBaseline<VectorEngine>(suite, name, order, sorted, hits, scans);
+}
+
+// Record-heavy trees: lookups and balance() with Student values stored in the node, in the
+// node array and in a separate value column.
+template<typename Tree>
+void RunRecordBenchmarks(BenchSuite& suite, const std::string& engine, const std::string& dist, Tree& tree,
+    const std::vector<int>& hits) {
+    volatile int sink = 0;
+    suite.SetEngine(engine);
+    suite.Point("record_lookup", dist, tree.Size(), hits.size(), [&]() { return &tree; },
+        [&](Tree* t, size_t i) { sink = sink + t->search(hits[i])->age; });
+    suite.Bulk("record_balance", dist, tree.Size(), [&]() { return &tree; }, [&](Tree* t) { t->balance(); });
+    suite.SetEngine("BinaryTree");
+}
+
+void RunRecords(BenchSuite& suite, size_t n, KeyDistribution dist) {
+    if (n == 0) return;
+    const std::string name = DistributionName(dist);
+
+    std::vector<int> order = GenerateKeys(n, dist, SEED);
+    std::vector<int> sorted = order;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<int> hits = GenerateAccesses(sorted, std::min(n, POINT_OPS), dist, SEED);
+
+    BinaryTree<Student> tree;
+    tree.setHeightBound(BenchBound(n));
+    for (int key : order) {
+        tree.insert(key, Student{ "Student with a long name " + std::to_string(key), 18 + key % 10, key,
+            "H98-10" + std::to_string(key % 5), key % 2 == 0 });
+    }
+    auto inlineTree = CompactBinaryTree<Student, false>::fromTree(tree);
+    auto coldTree = CompactBinaryTree<Student, true>::fromTree(tree);
+
+    volatile int sink = 0;
+    suite.Point("record_lookup", name, n, hits.size(), [&]() { return &tree; },
+        [&](BinaryTree<Student>* t, size_t i) { sink = sink + t->search(hits[i])->age; });
+    suite.Bulk("record_balance", name, n, [&]() { return &tree; }, [&](BinaryTree<Student>* t) { t->balance(); });
+
+    // Passing students aged 20..24: a traversal over the nodes against a scan of two columns.
+    volatile size_t passing = 0;
+    suite.Bulk("record_count_passing", name, n, [&]() { return &tree; }, [&](BinaryTree<Student>* t) {
+        size_t count = 0;
+        t->traverseLKP([&count](const Student& st) { count += st.exam_pass && st.age >= 20 && st.age <= 24; });
+        passing = count;
+    });
+    ColumnStore<Student> columns = ColumnStore<Student>::fromTree(tree);
+    suite.SetEngine("ColumnStore");
+    suite.Bulk("record_count_passing", name, n, [&]() { return &columns; },
+        [&](ColumnStore<Student>* c) { passing = c->countFlagged(20, 24); });
+    suite.SetEngine("BinaryTree");
+
+    // Keys of the students in one group: where() against a secondary index.
+    volatile size_t matches = 0;
+    suite.Bulk("record_group_query", name, n, [&]() { return &tree; }, [&](BinaryTree<Student>* t) {
+        size_t count = 0;
+        t->traverseRange(INT_MIN, INT_MAX, [&count](int, const Student& st) { count += st.group == "H98-103"; });
+        matches = count;
+    });
+    IndexedTree<Student> indexed;
+    indexed.setHeightBound(BenchBound(n));
+    tree.traverseRange(INT_MIN, INT_MAX, [&indexed](int key, const Student& st) { indexed.insert(key, st); });
+    indexed.indexFields();
+    suite.SetEngine("IndexedTree");
+    suite.Bulk("record_group_query", name, n, [&]() { return &indexed; },
+        [&](IndexedTree<Student>* t) { matches = t->equal("group", "H98-103").size(); });
+    suite.SetEngine("BinaryTree");
+
+    RunRecordBenchmarks(suite, "CompactBinaryTree", name, inlineTree, hits);
+    RunRecordBenchmarks(suite, "CompactBinaryTree/cold", name, coldTree, hits);
+}
+
+int main(int argc, char** argv) {
+    try {
+        Options opt = ParseOptions(argc, argv);
+        BenchSuite suite(opt.warmups, opt.reps);
+
+        for (size_t n : opt.sizes) {
+            for (KeyDistribution dist : opt.dists) {
+                if (opt.suite == "all" || opt.suite == "tree") RunSuite(suite, n, dist);
+                if (opt.suite == "all" || opt.suite == "baseline") RunBaselines(suite, n, dist);
+                if (opt.suite == "all" || opt.suite == "records") RunRecords(suite, n, dist);
+            }
+        }
+
+        suite.WriteCsv(opt.out + ".csv");
+        suite.WriteJson(opt.out + ".json");
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
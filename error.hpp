@@ -20,7 +20,8 @@ enum class ErrorCode {
     INDEX_OUT_OF_RANGE,
     INVALID_ARGUMENT,
     CONCAT_ERROR,
-    PARSE_ERROR
+    PARSE_ERROR,
+    FILE_ERROR
 };
 
 std::vector<Error> ErrorsList = {
@@ -33,7 +34,8 @@ std::vector<Error> ErrorsList = {
     {6, "Index out of range"},
     {7, "Invalid argument"},
     {8, "Cannot merge trees of different types"},
-    {9, "Parse error. Format is incorrect (correct format: ((()key:value())key:value(()key:value())) )"}
+    {9, "Parse error. Format is incorrect (correct format: ((()key:value())key:value(()key:value())) )"},
+    {10, "Cannot access file"}
 };
 
 namespace Errors {
@@ -104,4 +106,8 @@ namespace Errors {
         else
             return std::logic_error(ErrorsList[static_cast<int>(ErrorCode::PARSE_ERROR)].message + ": " + message);
     }
+
+    inline std::runtime_error FileError(const std::string& path) {
+        return std::runtime_error(ErrorsList[static_cast<int>(ErrorCode::FILE_ERROR)].message + ": " + path);
+    }
 }
\ No newline at end of file
@@ -2,16 +2,41 @@
 #include "test.hpp"
 
 #define FILENAME "result.csv"
+#define CHECKPOINT_FILENAME "checkpoint_result.csv"
 
 //#define STRESSTEST
 //#define BASETEST
 //#define DIFFTEST
+//#define SERIALTEST
+//#define CHECKPOINTTEST
+//#define RECOVERYTEST
+//#define HASHTEST
+//#define TREEDIFFTEST
+//#define VALUEINDEXTEST
+//#define HEIGHTBOUNDTEST
+//#define GENERATORTEST
+//#define STATSTEST
+//#define MEMORYTEST
+//#define COMPACTTEST
+//#define KEYTEST
+//#define COLUMNARTEST
+//#define INDEXTEST
+//#define AUGMENTTEST
+//#define SPLITTEST
+//#define BULKREMOVETEST
+//#define TOMBSTONETEST
+//#define HOTCACHETEST
+//#define KEYFILTERTEST
 
 int main() {
 #ifdef STRESSTEST
     StressTest(FILENAME);
 #endif
 
+#ifdef CHECKPOINTTEST
+    CheckpointStressTest(CHECKPOINT_FILENAME);
+#endif
+
 #ifdef BASETEST
     TreeBaseOperationsTest();
 #endif
@@ -20,6 +45,82 @@ int main() {
     TreeDiffOperationsTest();
 #endif
 
+#ifdef SERIALTEST
+    TreeSerializationTest();
+#endif
+
+#ifdef RECOVERYTEST
+    TreeRecoveryTest();
+#endif
+
+#ifdef HASHTEST
+    TreeHashTest();
+#endif
+
+#ifdef TREEDIFFTEST
+    TreeDiffTest();
+#endif
+
+#ifdef VALUEINDEXTEST
+    TreeValueIndexTest();
+#endif
+
+#ifdef HEIGHTBOUNDTEST
+    TreeHeightBoundTest();
+#endif
+
+#ifdef GENERATORTEST
+    TreeGeneratorTest();
+#endif
+
+#ifdef STATSTEST
+    TreeStatsTest();
+#endif
+
+#ifdef MEMORYTEST
+    TreeMemoryTest();
+#endif
+
+#ifdef COMPACTTEST
+    TreeCompactTest();
+#endif
+
+#ifdef KEYTEST
+    TreeKeyTest();
+#endif
+
+#ifdef COLUMNARTEST
+    TreeColumnarTest();
+#endif
+
+#ifdef INDEXTEST
+    TreeIndexTest();
+#endif
+
+#ifdef AUGMENTTEST
+    TreeAugmentTest();
+#endif
+
+#ifdef SPLITTEST
+    TreeSplitTest();
+#endif
+
+#ifdef BULKREMOVETEST
+    TreeBulkRemoveTest();
+#endif
+
+#ifdef TOMBSTONETEST
+    TreeTombstoneTest();
+#endif
+
+#ifdef HOTCACHETEST
+    TreeHotCacheTest();
+#endif
+
+#ifdef KEYFILTERTEST
+    TreeKeyFilterTest();
+#endif
+
     Run();
 
     return 0;
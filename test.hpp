@@ -3,6 +3,10 @@
 #include "BinaryTree.hpp"
 #include "User.hpp"
 #include "error.hpp"
+#include "Generator.hpp"
+#include "CompactTree.hpp"
+#include "Columnar.hpp"
+#include "IndexedTree.hpp"
 
 #include <iostream>
 #include <complex>
@@ -10,7 +14,12 @@
 #include <chrono>
 #include <cmath>
 #include <random>
+#include <map>
+#include <set>
+#include <sstream>
 #include <numeric>
+#include <algorithm>
+#include <cstdio>
 #include <assert.h>
 
 
@@ -223,20 +232,120 @@ void TreeDiffOperationsTest() {
     std::cout << "Binary tree different operations tests completed successfully\n";
 }
 
-void StressTest(const std::string& filename) {
+void TreeSerializationTest() {
+    std::cout << "Binary tree serialization tests: ";
+
+    BinaryTree<Student> tree1;
+    Student s1{ "Peter (the first), jr.", 24, 234, "H98-101", true };
+    Student s2{ "Nikolai: \\ok", 16, 376, "G56-903", false };
+    tree1.insert(2, s1);
+    tree1.insert(1, s2);
+
+    BinaryTree<Student> tree1_copy = BinaryTree<Student>::fromString(tree1.toString());
+    assert(tree1_copy == tree1);
+    assert(*tree1_copy.search(2) == s1);
+
+
+
+    BinaryTree<std::string> tree2;
+    tree2.insert(5, "a (b) c");
+    tree2.insert(3, "");
+    tree2.insert(7, "x,y:z");
+    assert(BinaryTree<std::string>::fromString(tree2.toString()) == tree2);
+
+
+
+    BinaryTree<std::complex<double>> tree3;
+    tree3.insert(1, { 1.5, -2.25 });
+    tree3.insert(2, { 0.1, 3 });
+    assert(BinaryTree<std::complex<double>>::fromString(tree3.toString()) == tree3);
+
+
+
+    Professor p1{ "Sokol Petrovich", 42, 340, "Camistry", true };
+    std::string bytes;
+    Codec<Professor>::writeBinary(bytes, p1);
+    Codec<double>::writeBinary(bytes, 0.1);
+    Codec<int>::writeBinary(bytes, -7);
+    size_t pos = 0;
+    assert(Codec<Professor>::readBinary(bytes, pos) == p1);
+    assert(Codec<double>::readBinary(bytes, pos) == 0.1);
+    assert(Codec<int>::readBinary(bytes, pos) == -7);
+    assert(pos == bytes.size());
+
+
+
+    BinaryTree<int> tree4;
+    for (int i : { 50, 20, 80, 10, 30, 70, 90, 25 }) tree4.insert(i, i * 3);
+    std::ostringstream binary;
+    tree4.toBinary(binary);
+    BinaryTree<int> tree4_copy = BinaryTree<int>::fromBinary(binary.str());
+    assert(tree4_copy == tree4);
+    assert(tree4_copy.toString() == tree4.toString());
+
+    std::ostringstream empty;
+    BinaryTree<Student>().toBinary(empty);
+    assert(BinaryTree<Student>::fromBinary(empty.str()).GetDepth() == 0);
+
+    // Preorder 2, 1, 3: a presence byte, then flags, key and value (1 + 4 + 4 bytes) per node.
+    BinaryTree<int> small;
+    for (int i : { 2, 1, 3 }) small.insert(i, i * 10);
+    std::ostringstream small_binary;
+    small.toBinary(small_binary);
+    std::string swapped = small_binary.str();
+    assert(swapped.size() == 28);
+    std::swap_ranges(swapped.begin() + 11, swapped.begin() + 15, swapped.begin() + 20);
+    bool threw = false;
+    try { BinaryTree<int>::fromBinary(swapped); }
+    catch (const std::invalid_argument&) { threw = true; }
+    assert(threw);
+
+    std::string flagged = small_binary.str();
+    flagged[1] |= 8;
+    threw = false;
+    try { BinaryTree<int>::fromBinary(flagged); }
+    catch (const std::invalid_argument&) { threw = true; }
+    assert(threw);
+    assert(BinaryTree<int>::fromBinary(small_binary.str()) == small);
+
+
+
+    BinaryTree<int> tree5;
+    for (int i = 0; i < 2000; ++i) tree5.insert((i * 7919) % 2003, i);
+    BinaryTree<int> tree5_before = tree5;
+
+    tree5.checkpoint("checkpoint_test.bin");
+    for (int i = 0; i < 2003; i += 3) tree5.remove(i);
+    for (int i = 0; i < 500; ++i) tree5.insert(5000 + i, i);
+    tree5.insert(1, -1);
+    tree5.waitCheckpoint();
+
+    std::ifstream checkpoint("checkpoint_test.bin", std::ios::binary);
+    std::string checkpoint_bytes((std::istreambuf_iterator<char>(checkpoint)), std::istreambuf_iterator<char>());
+    checkpoint.close();
+    std::remove("checkpoint_test.bin");
+
+    assert(BinaryTree<int>::fromBinary(checkpoint_bytes) == tree5_before);
+    assert(tree5.search(3) == nullptr);
+    assert(*tree5.search(1) == -1);
+    assert(*tree5.search(5499) == 499);
+
+    std::cout << "Binary tree serialization tests completed successfully\n";
+}
+
+void StressTest(const std::string& filename, KeyDistribution dist = KeyDistribution::Uniform) {
     std::cout << "Binary tree stress test: ";
 
     std::ofstream file(filename);
-    file << "N,InsertTimeMs,SearchTimeMs\n";
+    file << "N,InsertTimeMs,SearchTimeMs,BytesPerElement,PeakRssMb\n";
 
     for (int exp = 1; exp <= 7; ++exp) {
         size_t N = static_cast<size_t>(std::pow(10, exp));
 
         BinaryTree<int> tree;
+        if (InsertsPath(dist)) tree.setHeightBound(2 * MinHeight(N));
 
-        std::vector<int> keys(N);
-        std::iota(keys.begin(), keys.end(), 0);
-        std::shuffle(keys.begin(), keys.end(), std::mt19937{ std::random_device{}() });
+        std::vector<int> keys = GenerateKeys(N, dist, std::random_device{}());
 
         auto t1 = std::chrono::high_resolution_clock::now();
         for (int key : keys) {
@@ -252,10 +361,1251 @@ void StressTest(const std::string& filename) {
         t2 = std::chrono::high_resolution_clock::now();
         double search_time = std::chrono::duration<double, std::milli>(t2 - t1).count();
 
-        file << N << "," << insert_time << "," << search_time << "\n";
+        double bytes_per_element = tree.memoryUsage().bytesPerElement();
+        double peak_rss = Memory::PeakRss() / (1024.0 * 1024.0);
+
+        file << N << "," << insert_time << "," << search_time << "," << bytes_per_element << "," << peak_rss << "\n";
     }
 
     file.close();
 
     std::cout << "Binary tree stress test completed successfully\n";
+}
+
+
+
+void TreeRecoveryTest() {
+    std::cout << "Binary tree recovery tests: ";
+
+    BinaryTree<int> tree1;
+    for (int i : { 50, 20, 80, 10, 30, 70, 90, 25, 35, 95 }) tree1.insert(i, i);
+
+    std::string KLP, LKP, LPK;
+    tree1.traverseKLP([&](const int& v) { KLP += std::to_string(v) + " "; });
+    tree1.traverseLKP([&](const int& v) { LKP += std::to_string(v) + " "; });
+    tree1.traverseLPK([&](const int& v) { LPK += std::to_string(v) + " "; });
+
+    assert(BinaryTree<int>::recoveryTree(KLP, LKP) == tree1);
+    assert(BinaryTree<int>::recoveryFromKLP(KLP) == tree1);
+    assert(BinaryTree<int>::recoveryFromLPK(LPK) == tree1);
+    assert(BinaryTree<int>::recoveryFromKLP(KLP).toString() == tree1.toString());
+
+
+
+    bool thrown = false;
+    try { BinaryTree<int>::recoveryTree("2 1 3", "1 3 2"); }
+    catch (const std::invalid_argument&) { thrown = true; }
+    assert(thrown);
+
+    thrown = false;
+    try { BinaryTree<int>::recoveryFromKLP("2 3 1"); }
+    catch (const std::invalid_argument&) { thrown = true; }
+    assert(thrown);
+
+    thrown = false;
+    try { BinaryTree<int>::recoveryFromLPK("1 1"); }
+    catch (const std::invalid_argument&) { thrown = true; }
+    assert(thrown);
+
+
+
+    const int N = 200000;
+    std::string deepKLP, deepLKP;
+    for (int i = N; i >= 1; --i) deepKLP += std::to_string(i) + " ";
+    for (int i = 1; i <= N; ++i) deepLKP += std::to_string(i) + " ";
+
+    BinaryTree<int> deep = BinaryTree<int>::recoveryTree(deepKLP, deepLKP);
+    assert(*deep.search(1) == 1);
+    BinaryTree<int> deep2 = BinaryTree<int>::recoveryFromKLP(deepKLP);
+    assert(*deep2.search(N) == N);
+
+    std::cout << "Binary tree recovery tests completed successfully\n";
+}
+
+
+
+
+void TreeGeneratorTest() {
+    std::cout << "Binary tree generator tests: ";
+
+    for (int d = 0; d < 6; ++d) {
+        KeyDistribution dist = static_cast<KeyDistribution>(d);
+        assert(ParseDistribution(DistributionName(dist)) == dist);
+
+        std::vector<int> keys = GenerateKeySet(100000, dist, 42, 4);
+        assert(std::is_sorted(keys.begin(), keys.end()));
+        assert(std::adjacent_find(keys.begin(), keys.end()) == keys.end());
+        assert(keys == GenerateKeySet(100000, dist, 42, 1));
+
+        std::vector<int> order = GenerateKeys(100000, dist, 42, 4);
+        std::sort(order.begin(), order.end());
+        assert(order == keys);
+
+        BinaryTree<int> balanced = GenerateTree(100000, dist, TreeShape::Balanced, 17, 42, 4);
+        assert(balanced.GetDepth() == 17);
+        for (size_t i = 0; i < keys.size(); i += 997) assert(*balanced.search(keys[i]) == keys[i]);
+
+        BinaryTree<int> inserted = GenerateTree(5000, dist, TreeShape::Inserted, 16, 42);
+        assert(inserted.GetDepth() <= 16);
+
+        BinaryTree<int> unbounded = GenerateTree(20000, dist, TreeShape::Inserted, 0, 42);
+        assert(!InsertsPath(dist) || unbounded.GetDepth() <= 2 * MinHeight(20000));
+    }
+
+    for (KeyDistribution dist : { KeyDistribution::Uniform, KeyDistribution::Zipfian, KeyDistribution::Clustered }) {
+        std::vector<int> small = GenerateKeySet(60, dist, 7);
+        assert(small.back() <= 1000);
+        std::vector<int> large = GenerateKeySet(3000, dist, 7);
+        assert(large.back() < 3000 * 16);
+    }
+
+    std::vector<int> accesses = GenerateAccesses(GenerateKeySet(1000, KeyDistribution::Sorted, 1), 10000, KeyDistribution::Zipfian, 1);
+    std::map<int, int> hits;
+    for (int key : accesses) ++hits[key];
+    std::vector<int> counts;
+    for (const auto& [key, count] : hits) counts.push_back(count);
+    std::sort(counts.rbegin(), counts.rend());
+    // Uniform accesses would give each key about 10 hits and the top tenth of the keys a tenth of
+    // them; zipfian ones pile onto the hottest keys.
+    assert(counts[0] > 500);
+    assert(std::accumulate(counts.begin(), counts.begin() + std::min<size_t>(100, counts.size()), 0) > 5000);
+
+    bool thrown = false;
+    try { GenerateTree(1000, KeyDistribution::Uniform, TreeShape::Balanced, 5, 1); }
+    catch (const std::invalid_argument&) { thrown = true; }
+    assert(thrown);
+
+    thrown = false;
+    try { GenerateTree(1000, KeyDistribution::Uniform, TreeShape::Inserted, 5, 1); }
+    catch (const std::invalid_argument&) { thrown = true; }
+    assert(thrown);
+
+    std::cout << "Binary tree generator tests completed successfully\n";
+}
+
+
+
+void TreeHashTest() {
+    std::cout << "Binary tree subtree hashing tests: ";
+
+    BinaryTree<int> tree1;
+    for (int i : { 50, 20, 80, 10, 30, 70, 90, 25, 35 }) tree1.insert(i, i);
+
+    BinaryTree<int> sub1;
+    for (int i : { 30, 25, 35 }) sub1.insert(i, i);
+    assert(tree1.containsSubtree(sub1));
+    assert(tree1.containsSubtree(tree1.extractSubtree(20)));
+
+    BinaryTree<int> sub2;
+    for (int i : { 30, 25 }) sub2.insert(i, i);
+    assert(!tree1.containsSubtree(sub2));
+
+    tree1.remove(35);
+    assert(tree1.containsSubtree(sub2));
+    assert(!tree1.containsSubtree(sub1));
+
+    tree1.insert(35, 35);
+    assert(tree1.containsSubtree(sub1));
+
+    tree1.insert(35, 36);
+    assert(!tree1.containsSubtree(sub1));
+
+
+
+    BinaryTree<int> tree2 = tree1;
+    assert(tree2 == tree1);
+    tree2.insert(35, 35);
+    assert(tree2 != tree1);
+    tree1.insert(35, 35);
+    assert(tree2 == tree1);
+
+
+
+    BinaryTree<Student> tree3;
+    Student s1{ "Peter", 24, 234, "H98-101", true };
+    Student s2{ "Nikolai", 16, 376, "G56-903", true };
+    tree3.insert(2, s1);
+    tree3.insert(1, s2);
+    BinaryTree<Student> sub3;
+    sub3.insert(1, s2);
+    assert(tree3.containsSubtree(sub3));
+
+
+
+    BinaryTree<int> tree4;
+    tree4.enableHashing();
+    tree4.setTombstoneRatio(0.25);
+    std::mt19937 rng(17);
+    for (int round = 0; round < 2000; ++round) {
+        int key = static_cast<int>(rng() % 300);
+        switch (rng() % 8) {
+        case 0: case 1: case 2: tree4.insert(key, round); break;
+        case 3: case 4: tree4.remove(key); break;
+        case 5: tree4.removeIf([key](const int& v) { return v % 97 == key % 97; }); break;
+        case 6: tree4.removeRange(key, key + 5); break;
+        default: {
+            BinaryTree<int> upper = tree4.split(key);
+            assert(upper.hashingEnabled());
+            tree4.join(upper);
+        }
+        }
+        if (round % 250 == 0) tree4.balance();
+        if (round % 50 == 0) {
+            BinaryTree<int> lazy = tree4;
+            lazy.enableHashing(false);
+            assert(lazy.digest() == tree4.digest());
+            assert(lazy.diff(tree4).empty() && tree4.diff(lazy).empty());
+            assert(tree4.containsSubtree(lazy) && lazy.containsSubtree(tree4));
+        }
+    }
+
+    std::cout << "Binary tree subtree hashing tests completed successfully\n";
+}
+
+
+
+void TreeDiffTest() {
+    std::cout << "Binary tree diff and patch tests: ";
+
+    BinaryTree<int> source;
+    for (int i = 0; i < 1009; ++i) source.insert((i * 7919) % 1009, i);
+    BinaryTree<int> replica = source;
+    assert(source.diff(replica).empty());
+
+    source.insert(5000, 1);
+    source.insert(7, -7);
+    source.remove(100);
+    source.remove(500);
+
+    BinaryTree<int>::Diff d = replica.diff(source);
+    assert(d.inserted.size() == 1 && d.inserted[0].first == 5000);
+    assert(d.changed.size() == 1 && d.changed[0].first == 7);
+    assert(d.removed.size() == 2);
+
+    std::string shipped;
+    d.toBinary(shipped);
+    size_t pos = 0;
+    replica.patch(BinaryTree<int>::Diff::fromBinary(shipped, pos));
+    assert(replica.diff(source).empty());
+    assert(*replica.search(7) == -7);
+    assert(replica.search(100) == nullptr);
+
+    std::cout << "Binary tree diff and patch tests completed successfully\n";
+}
+
+
+
+void TreeValueIndexTest() {
+    std::cout << "Binary tree value index tests: ";
+
+    BinaryTree<std::string> tree1;
+    tree1.enableValueIndex();
+    tree1.insert(5, "five");
+    tree1.insert(3, "three");
+    tree1.insert(7, "seven");
+    tree1.insert(6, "six");
+    assert(tree1.containsNode("six"));
+    assert(*tree1.findByRelativePath("L", "seven") == "six");
+
+    tree1.remove(5);
+    assert(!tree1.containsNode("five"));
+    assert(tree1.containsNode("six") && tree1.containsNode("three"));
+    tree1.insert(3, "drei");
+    assert(!tree1.containsNode("three") && tree1.containsNode("drei"));
+    tree1.balance();
+    assert(tree1.containsNode("seven"));
+    assert(tree1.valueIndexMemory() > 0);
+
+    BinaryTree<std::string> tree1_copy = tree1;
+    assert(tree1_copy.valueIndexEnabled() && tree1_copy.containsNode("drei"));
+    tree1.enableValueIndex(false);
+    assert(tree1.valueIndexMemory() == 0 && tree1.containsNode("drei"));
+
+    std::cout << "Binary tree value index tests completed successfully\n";
+}
+
+
+
+void TreeHeightBoundTest() {
+    std::cout << "Binary tree height bound tests: ";
+
+    BinaryTree<int> tree1;
+
+    const int N = 1000;
+    for (int i = 0; i < N; ++i) tree1.insert(i, i * 2);
+    for (int i = 0; i < N; i += 100) assert(tree1.remove(i));
+
+    assert(tree1.GetDepth() == N - N / 100);
+    tree1.balance();
+    assert(tree1.GetDepth() == 10);
+
+
+
+    BinaryTree<int> tree2;
+    tree2.setHeightBound(12);
+    for (int i = 0; i < N; ++i) {
+        tree2.insert(i, i);
+        assert(tree2.GetDepth() <= 12);
+    }
+    for (int i = N; i > 0; --i) {
+        tree2.insert(N + i * 3, i);
+        assert(tree2.GetDepth() <= 12);
+    }
+    for (int i = 0; i < N; ++i) assert(*tree2.search(i) == i);
+    for (int i = 1; i <= N; ++i) assert(*tree2.search(N + i * 3) == i);
+
+    std::vector<int> scanned;
+    tree2.traverseRange(990, 1010, [&](int key, const int&) { scanned.push_back(key); });
+    assert((scanned == std::vector<int>{ 990, 991, 992, 993, 994, 995, 996, 997, 998, 999, 1003, 1006, 1009 }));
+    scanned.clear();
+    tree2.traverseRange(5, 4, [&](int key, const int&) { scanned.push_back(key); });
+    assert(scanned.empty());
+
+    bool thrown = false;
+    try { tree2.setHeightBound(10); }
+    catch (const std::invalid_argument&) { thrown = true; }
+    assert(thrown && tree2.heightBound() == 12);
+
+    BinaryTree<int> tree3;
+    tree3.setHeightBound(3);
+    for (int i = 0; i < 7; ++i) tree3.insert(i, i);
+    assert(tree3.GetDepth() == 3);
+    for (int i = 7; i < 20; ++i) tree3.insert(i, i);
+    for (int i = 0; i < 20; ++i) assert(*tree3.search(i) == i);
+    assert(tree3.heightBound() == 3);
+
+    std::cout << "Binary tree height bound tests completed successfully\n";
+}
+
+
+
+double Percentile(std::vector<double> samples, double p) {
+    if (samples.empty()) return 0;
+    size_t idx = static_cast<size_t>(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+    return samples[idx];
+}
+
+void CheckpointStressTest(const std::string& filename) {
+    std::cout << "Binary tree checkpoint stress test: ";
+
+    std::ofstream file(filename);
+    file << "N,Mode,Ops,P50Us,P99Us,MaxUs\n";
+
+    std::mt19937 rng{ std::random_device{}() };
+
+    for (int exp = 4; exp <= 6; ++exp) {
+        int N = static_cast<int>(std::pow(10, exp));
+
+        BinaryTree<int> tree;
+        std::vector<int> keys(N);
+        std::iota(keys.begin(), keys.end(), 0);
+        std::shuffle(keys.begin(), keys.end(), rng);
+        for (int key : keys) tree.insert(key, key);
+
+        std::uniform_int_distribution<int> dist(0, 2 * N);
+        auto measure = [&](const std::string& mode, bool withCheckpoint) {
+            std::vector<double> latencies;
+            if (withCheckpoint) tree.checkpoint("checkpoint_stress.bin");
+
+            while (withCheckpoint ? tree.checkpointRunning() : latencies.size() < static_cast<size_t>(N)) {
+                int key = dist(rng);
+                auto t1 = std::chrono::high_resolution_clock::now();
+                if (key % 2) tree.insert(key, key);
+                else tree.remove(key);
+                auto t2 = std::chrono::high_resolution_clock::now();
+                latencies.push_back(std::chrono::duration<double, std::micro>(t2 - t1).count());
+            }
+
+            if (withCheckpoint) tree.waitCheckpoint();
+            file << N << "," << mode << "," << latencies.size() << "," << Percentile(latencies, 0.5) << ","
+                << Percentile(latencies, 0.99) << "," << Percentile(latencies, 1.0) << "\n";
+        };
+
+        measure("idle", false);
+        measure("checkpoint", true);
+    }
+
+    std::remove("checkpoint_stress.bin");
+    file.close();
+
+    std::cout << "Binary tree checkpoint stress test completed successfully\n";
+}
+
+
+
+void TreeStatsTest() {
+    std::cout << "Binary tree stats tests: ";
+
+    BinaryTree<int> tree;
+    tree.setHeightBound(8);
+    for (int i = 0; i < 100; ++i) tree.insert(i, i);
+    for (int i = 0; i < 100; ++i) assert(*tree.search(i) == i);
+    assert(tree.search(1000) == nullptr);
+    for (int i = 0; i < 100; i += 2) assert(tree.remove(i));
+
+    TreeStats stats = tree.stats();
+    if (stats.enabled) {
+        assert(stats.allocations == 100 && stats.frees == 50);
+        assert(stats.rebalances > 0);
+        assert(stats.comparisons > 0 && stats.nodesVisited >= stats.comparisons);
+        assert(stats.insertLatency.count == 100 && stats.searchLatency.count == 101 && stats.removeLatency.count == 50);
+        assert(stats.insertLatency.percentile(0.5) <= stats.insertLatency.percentile(0.99));
+
+        std::string text = tree.toString();
+        assert(tree.stats().bytesSerialized == text.size());
+        BinaryTree<int> parsed = BinaryTree<int>::fromString(text);
+        assert(parsed.stats().bytesParsed == text.size() && parsed.stats().allocations >= 50);
+
+        assert(tree.stats().toJson().find("\"allocations\": 100") != std::string::npos);
+        BinaryTree<int> copied = tree;
+        assert(copied.stats().allocations == 50 && copied.stats().frees == 0);
+        tree.resetStats();
+        assert(tree.stats().comparisons == 0 && tree.stats().insertLatency.count == 0);
+    }
+    else {
+        assert(stats.comparisons == 0 && stats.insertLatency.count == 0);
+        assert(stats.toJson().find("\"enabled\": false") != std::string::npos);
+    }
+
+    std::cout << "Binary tree stats tests completed successfully\n";
+}
+
+
+
+void TreeMemoryTest() {
+    std::cout << "Binary tree memory usage tests: ";
+
+    BinaryTree<int> tree1;
+    assert(tree1.memoryUsage().total() == 0);
+    for (int i = 0; i < 100; ++i) tree1.insert(i, i);
+
+    MemoryUsage usage1 = tree1.memoryUsage();
+    assert(usage1.nodes == 100);
+    assert(usage1.valuePayload == 100 * sizeof(int));
+    assert(usage1.valueHeap == 0 && usage1.indexBytes == 0);
+    assert(usage1.nodeOverhead + usage1.valuePayload + usage1.allocatorSlack >= 100 * 3 * sizeof(void*));
+
+    BinaryTree<Student> tree2;
+    tree2.insert(1, Student{ "Ann", 19, 1, "H98-101", true });
+    std::string longName(100, 'x');
+    tree2.insert(2, Student{ longName, 20, 2, "H98-101", false });
+
+    MemoryUsage usage2 = tree2.memoryUsage();
+    assert(usage2.nodes == 2);
+    assert(usage2.valuePayload == 2 * sizeof(Student));
+    assert(usage2.valueHeap >= longName.size() + 1 && usage2.valueHeap < 2 * longName.size());
+
+    tree2.enableValueIndex();
+    assert(tree2.memoryUsage().indexBytes == tree2.valueIndexMemory());
+    assert(tree2.memoryUsage().total() > usage2.total());
+
+    assert(Memory::AllocatedSize(1) == 32 && Memory::Slack(48) == 16);
+
+    std::cout << "Binary tree memory usage tests completed successfully\n";
+}
+
+
+
+void TreeCompactTest() {
+    std::cout << "Compact binary tree tests: ";
+
+    CompactBinaryTree<int> tree1;
+    BinaryTree<int> reference;
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> dist(0, 499);
+    for (int i = 0; i < 5000; ++i) {
+        int key = dist(rng);
+        if (i % 3 == 2) assert(tree1.remove(key) == reference.remove(key));
+        else {
+            tree1.insert(key, key * 2);
+            reference.insert(key, key * 2);
+        }
+    }
+    for (int key = 0; key < 500; ++key) {
+        const int* found = tree1.search(key);
+        int* expected = reference.search(key);
+        assert((found == nullptr) == (expected == nullptr));
+        if (found) assert(*found == *expected);
+    }
+
+    std::vector<int> compactOrder, referenceOrder;
+    tree1.traverseLKP([&](const int& v) { compactOrder.push_back(v); });
+    reference.traverseLKP([&](const int& v) { referenceOrder.push_back(v); });
+    assert(compactOrder == referenceOrder);
+    assert(tree1.Size() == static_cast<int>(referenceOrder.size()));
+    assert(tree1.getMin() == reference.getMin() && tree1.getMax() == reference.getMax());
+
+    CompactBinaryTree<int> tree2 = tree1;
+    tree2.insert(1000, 1);
+    assert(tree1.search(1000) == nullptr && *tree2.search(1000) == 1);
+
+    tree1.balance();
+    compactOrder.clear();
+    tree1.traverseLKP([&](const int& v) { compactOrder.push_back(v); });
+    assert(compactOrder == referenceOrder);
+    int n = tree1.Size(), minDepth = 0;
+    for (int m = n; m > 0; m >>= 1) ++minDepth;
+    assert(tree1.GetDepth() == minDepth);
+
+    MemoryUsage usage = tree1.memoryUsage();
+    assert(usage.nodes == static_cast<size_t>(n));
+    assert(usage.nodeOverhead + usage.valuePayload == static_cast<size_t>(n) * 16);
+    MemoryUsage pointerUsage = reference.memoryUsage();
+    if (sizeof(void*) == 8) assert(pointerUsage.nodeOverhead + pointerUsage.valuePayload == pointerUsage.nodes * 32);
+
+    CompactBinaryTree<int> tree3;
+    for (int i = 0; i < 20000; ++i) tree3.insert(i, i);
+    assert(tree3.GetDepth() == 20000);
+    std::vector<int> post;
+    tree3.traverseLPK([&](const int& v) { post.push_back(v); });
+    assert(post.size() == 20000 && post.front() == 19999 && post.back() == 0);
+
+    CompactBinaryTree<int> tree4 = CompactBinaryTree<int>::fromTree(reference);
+    std::vector<int> range;
+    tree4.traverseRange(10, 20, [&](int key, const int& v) { assert(v == key * 2); range.push_back(key); });
+    std::vector<int> expectedRange;
+    reference.traverseRange(10, 20, [&](int key, const int&) { expectedRange.push_back(key); });
+    assert(range == expectedRange);
+    tree4.traverseRange(INT_MAX - 1, INT_MAX, [](int, const int&) { assert(false); });
+    reference.traverseRange(INT_MAX - 1, INT_MAX, [](int, const int&) { assert(false); });
+
+    CompactBinaryTree<std::string> tree5;
+    tree5.insert(2, "two");
+    tree5.insert(1, "one");
+    assert(tree5.remove(2) && !tree5.remove(2));
+    tree5.insert(3, "three");
+    assert(*tree5.search(3) == "three" && tree5.Size() == 2);
+
+    CompactBinaryTree<Student> cold;
+    CompactBinaryTree<Student, false> hot;
+    for (int i = 0; i < 200; ++i) {
+        Student st{ "Student number " + std::to_string(i), 18 + i % 10, i, "H98-10" + std::to_string(i % 3), i % 2 == 0 };
+        cold.insert((i * 37) % 200, st);
+        hot.insert((i * 37) % 200, st);
+    }
+    for (int i = 0; i < 200; i += 3) assert(cold.remove(i) && hot.remove(i));
+    cold.insert(1000, Student{ "Late", 20, 1000, "H98-101", true });
+    hot.insert(1000, Student{ "Late", 20, 1000, "H98-101", true });
+    cold.balance();
+    for (int i = 0; i <= 1000; ++i) {
+        const Student* a = cold.search(i);
+        const Student* b = hot.search(i);
+        assert((a == nullptr) == (b == nullptr));
+        if (a) assert(*a == *b);
+    }
+    assert(cold.memoryUsage().valuePayload == hot.memoryUsage().valuePayload);
+    assert(cold.memoryUsage().valueHeap == hot.memoryUsage().valueHeap);
+
+    std::cout << "Compact binary tree tests completed successfully\n";
+}
+
+void TreeKeyTest() {
+    std::cout << "Key type tests: ";
+
+    BinaryTree<Student, std::string> byName;
+    std::vector<std::string> names = { "Ivanov", "Petrov", "Sidorov", "Alekseev", "Morozov", "Kuznetsov", "Volkov" };
+    for (size_t i = 0; i < names.size(); ++i) {
+        byName.insert(names[i], Student{ names[i], 18 + static_cast<int>(i), static_cast<int>(i), "H98-101", i % 2 == 0 });
+    }
+
+    std::string_view view = "Sidorov";
+    assert(byName.search(view) && byName.search(view)->name == "Sidorov");
+    assert(byName.search("Volkov") && byName.search(std::string("Ivanov")));
+    assert(byName.search("Smirnov") == nullptr && byName.search(std::string_view("Sidorov2")) == nullptr);
+
+    std::vector<std::string> ordered;
+    byName.traverseRange("B", "P", [&](const std::string& key, const Student& st) {
+        assert(key == st.name);
+        ordered.push_back(key);
+        });
+    assert((ordered == std::vector<std::string>{ "Ivanov", "Kuznetsov", "Morozov" }));
+
+    assert(byName.remove("Petrov") && !byName.remove("Petrov"));
+    byName.balance();
+    assert(byName.search("Petrov") == nullptr && byName.search("Alekseev"));
+
+    BinaryTree<Student, std::string> restored = BinaryTree<Student, std::string>::fromString(byName.toString());
+    assert(restored == byName && restored.digest() == byName.digest());
+    std::ostringstream os;
+    byName.toBinary(os);
+    assert((BinaryTree<Student, std::string>::fromBinary(os.str()) == byName));
+
+    restored.insert("Zaitsev", Student{ "Zaitsev", 30, 100, "H98-102", true });
+    restored.remove("Ivanov");
+    auto d = byName.diff(restored);
+    std::string bytes;
+    d.toBinary(bytes);
+    size_t pos = 0;
+    byName.patch(BinaryTree<Student, std::string>::Diff::fromBinary(bytes, pos));
+    assert(byName.digest() == restored.digest() && byName.search("Zaitsev") && !byName.search("Ivanov"));
+
+    BinaryTree<int, int, std::greater<>> descending;
+    for (int i = 0; i < 100; ++i) descending.insert((i * 37) % 100, i);
+    std::vector<int> keys;
+    descending.traverseRange(90, 80, [&](int key, const int&) { keys.push_back(key); });
+    assert((keys == std::vector<int>{ 90, 89, 88, 87, 86, 85, 84, 83, 82, 81, 80 }));
+    assert(*descending.search(37) == 1);
+    BinaryTree<int, int, std::greater<>> check;
+    assert(check.isValidTreeString(descending.toString()));
+    assert(!BinaryTree<int>().isValidTreeString(descending.toString()));
+
+    std::cout << "Key type tests completed successfully\n";
+}
+
+void TreeColumnarTest() {
+    std::cout << "Columnar store tests: ";
+
+    BinaryTree<Student> students;
+    for (int i = 0; i < 1000; ++i) {
+        int key = (i * 7919) % 1000;
+        students.insert(key, Student{ "Student " + std::to_string(key), 17 + key % 13, key, "H98-10" + std::to_string(key % 4), key % 3 != 0 });
+    }
+    students.remove(500);
+
+    ColumnStore<Student> columns = ColumnStore<Student>::fromTree(students);
+    assert(columns.Size() == 999);
+
+    size_t row = 0;
+    students.traverseRange(INT_MIN, INT_MAX, [&](int key, const Student& st) {
+        assert(columns.key(row) == key && columns.row(row) == st);
+        ++row;
+        });
+    assert(columns.find(500) == ColumnStore<Student>::npos && columns.row(columns.find(42)).age == 17 + 42 % 13);
+
+    for (int lo = 15; lo <= 31; lo += 4) {
+        for (int hi = lo - 1; hi <= 31; hi += 3) {
+            size_t age = 0, passing = 0;
+            std::vector<size_t> selected;
+            row = 0;
+            students.traverseRange(INT_MIN, INT_MAX, [&](int, const Student& st) {
+                if (st.age >= lo && st.age <= hi) {
+                    ++age;
+                    if (st.exam_pass) ++passing;
+                    selected.push_back(row);
+                }
+                ++row;
+                });
+            assert(columns.countAge(lo, hi) == age);
+            assert(columns.countFlagged(lo, hi) == passing);
+            assert(columns.selectAge(lo, hi) == selected);
+        }
+    }
+
+    auto [first, last] = columns.rows(100, 199);
+    assert(first == 100 && last == 200);
+    int64_t sum = 0;
+    size_t passing = 0;
+    students.traverseRange(100, 199, [&](int, const Student& st) {
+        sum += st.age;
+        if (st.exam_pass && st.age >= 20 && st.age <= 25) ++passing;
+        });
+    assert(columns.sumAge(first, last) == sum && columns.countFlagged(20, 25, first, last) == passing);
+    assert(columns.meanAge(first, last) == static_cast<double>(sum) / 100);
+    assert(columns.rows(2000, 3000).first == columns.rows(2000, 3000).second);
+    assert(columns.countAge(INT_MIN, INT_MAX) == 999 && columns.countAge(30, 20) == 0);
+
+    BinaryTree<Professor> professors;
+    professors.insert(2, Professor{ "Smirnov", 50, 2, "Algebra", true });
+    professors.insert(1, Professor{ "Orlova", 41, 1, "Geometry", false });
+    ColumnStore<Professor> staff = ColumnStore<Professor>::fromTree(professors);
+    assert(staff.row(0).subject == "Geometry" && staff.countFlagged(0, 100) == 1);
+
+    std::cout << "Columnar store tests completed successfully\n";
+}
+
+void TreeIndexTest() {
+    std::cout << "Secondary index tests: ";
+
+    IndexedTree<Student> students;
+    for (int i = 0; i < 300; ++i) {
+        students.insert(i, Student{ "Student " + std::to_string(i), 17 + i % 10, i, "H98-10" + std::to_string(i % 6), i % 4 != 0 });
+    }
+    students.indexFields();
+    students.indexInt("id", [](const Student& st) { return st.id; }, IndexKind::Hashed);
+    assert(students.hasIndex("group") && students.hasIndex("age") && students.hasIndex("exam_pass") && !students.hasIndex("subject"));
+    assert(students.pool().Size() == 6);
+
+    for (int i = 0; i < 300; i += 5) students.remove(i);
+    for (int i = 300; i < 320; ++i) students.insert(i, Student{ "Late " + std::to_string(i), 30, i, "H98-107", true });
+    students.insert(1, Student{ "Moved", 40, 1, "H98-107", false });
+    students.balance();
+    assert(students.pool().Size() == 7);
+
+    auto where = [&](std::function<bool(const Student&)> p) {
+        std::vector<int> keys;
+        students.tree().traverseRange(INT_MIN, INT_MAX, [&](int key, const Student& st) { if (p(st)) keys.push_back(key); });
+        return keys;
+    };
+    auto sorted = [](std::vector<int> keys) {
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    };
+
+    for (int g = 0; g <= 8; ++g) {
+        std::string group = "H98-10" + std::to_string(g);
+        assert(sorted(students.equal("group", group)) == where([&](const Student& st) { return st.group == group; }));
+    }
+    assert(students.equal("group", std::string_view("H98-999")).empty());
+    assert(students.equal("exam_pass", 0) == where([](const Student& st) { return !st.exam_pass; }));
+    assert(students.equal("age", 40) == std::vector<int>{ 1 });
+    assert(students.equal("id", 7) == std::vector<int>{ 7 } && students.equal("id", 10).empty());
+
+    std::vector<int> adults = students.range("age", 20, 25);
+    assert(sorted(adults) == where([](const Student& st) { return st.age >= 20 && st.age <= 25; }));
+    for (size_t i = 1; i < adults.size(); ++i) assert(students.search(adults[i - 1])->age <= students.search(adults[i])->age);
+    assert(students.range("age", 25, 20).empty());
+
+    bool threw = false;
+    try { students.range("group", 0, 1); }
+    catch (const std::invalid_argument&) { threw = true; }
+    assert(threw);
+    threw = false;
+    try { students.equal("salary", 1); }
+    catch (const std::invalid_argument&) { threw = true; }
+    assert(threw);
+
+    IndexedTree<Professor> professors;
+    professors.indexFields();
+    professors.insert(1, Professor{ "Smirnov", 50, 1, "Algebra", true });
+    professors.insert(2, Professor{ "Orlova", 41, 2, "Geometry", false });
+    professors.insert(3, Professor{ "Popov", 62, 3, "Algebra", true });
+    assert(sorted(professors.equal("subject", "Algebra")) == (std::vector<int>{ 1, 3 }));
+    assert(professors.remove(1) && !professors.remove(1));
+    assert(professors.equal("subject", "Algebra") == std::vector<int>{ 3 } && professors.equal("be_on_exam", 1) == std::vector<int>{ 3 });
+
+    std::cout << "Secondary index tests completed successfully\n";
+}
+
+// Concatenates the values in key order; not commutative, so it also checks the combine order.
+struct ConcatAugment {
+    using Value = std::string;
+    static Value identity() { return ""; }
+    static Value lift(const std::string& value) { return value; }
+    static Value combine(const Value& a, const Value& b) { return a + b; }
+};
+
+void TreeAugmentTest() {
+    std::cout << "Augmented tree tests: ";
+
+    AugmentedTree<int, RangeStats<int>> tree;
+    BinaryTree<int> reference;
+    std::mt19937 rng(7);
+    for (int i = 0; i < 3000; ++i) {
+        int key = static_cast<int>(rng() % 1000), value = static_cast<int>(rng() % 2001) - 1000;
+        if (rng() % 4 == 0) {
+            assert(tree.remove(key) == reference.remove(key));
+        }
+        else {
+            tree.insert(key, value);
+            reference.insert(key, value);
+        }
+        if (i == 1500) tree.balance();
+        if (i == 2000) tree.setHeightBound(14);
+    }
+
+    for (int q = 0; q < 500; ++q) {
+        int lo = static_cast<int>(rng() % 1100) - 50, hi = lo + static_cast<int>(rng() % 300) - 20;
+        RangeStats<int>::Value expected;
+        reference.traverseRange(lo, hi, [&](int, const int& v) { expected = RangeStats<int>::combine(expected, RangeStats<int>::lift(v)); });
+        RangeStats<int>::Value got = tree.aggregate(lo, hi);
+        assert(got.count == expected.count && got.sum == expected.sum);
+        if (got.count) assert(got.min == expected.min && got.max == expected.max);
+    }
+    RangeStats<int>::Value all = tree.aggregate();
+    RangeStats<int>::Value everything = tree.aggregate(INT_MIN, INT_MAX);
+    assert(all.count == everything.count && all.sum == everything.sum && all.min == everything.min);
+
+    AugmentedTree<int, RangeStats<int>> copy = AugmentedTree<int, RangeStats<int>>::fromString(tree.toString());
+    assert(copy.aggregate(100, 700).sum == tree.aggregate(100, 700).sum);
+    copy = tree;
+    copy.remove(copy.getMin());
+    assert(copy.aggregate(INT_MIN, INT_MAX).count <= tree.aggregate().count);
+
+    AugmentedTree<std::string, ConcatAugment> text;
+    std::string letters = "thequickbrownfoxjumpsoverthelazydog";
+    for (size_t i = 0; i < letters.size(); ++i) text.insert(static_cast<int>((i * 11) % letters.size()), std::string(1, letters[i]));
+    std::string ordered;
+    text.traverseLKP([&](const std::string& s) { ordered += s; });
+    for (int lo = 0; lo < 35; lo += 3) {
+        for (int hi = lo; hi < 40; hi += 5) assert(text.aggregate(lo, hi) == ordered.substr(lo, std::min(hi, 34) - lo + 1));
+    }
+    text.balance();
+    assert(text.aggregate() == ordered && text.aggregate(10, 5).empty());
+
+    AugmentedTree<std::complex<double>, RangeSum<std::complex<double>>> waves;
+    for (int i = 1; i <= 10; ++i) waves.insert(i, std::complex<double>(i, -i));
+    assert(waves.aggregate(3, 5) == std::complex<double>(12, -12));
+
+    AugmentedTree<double, RangeMax<double>> peaks;
+    assert(peaks.aggregate(0, 10) == -std::numeric_limits<double>::infinity());
+    for (int i = 0; i < 100; ++i) peaks.insert(i, std::sin(i * 0.1));
+    assert(peaks.aggregate(0, 20) == std::sin(1.6));
+
+    std::cout << "Augmented tree tests completed successfully\n";
+}
+
+void TreeSplitTest() {
+    std::cout << "Split and join tests: ";
+
+    auto keysOf = [](const BinaryTree<int>& tree) {
+        std::vector<int> keys;
+        tree.traverseRange(INT_MIN, INT_MAX, [&](int key, const int& value) {
+            assert(value == key * 3);
+            keys.push_back(key);
+            });
+        return keys;
+    };
+
+    std::vector<int> sorted(4096);
+    for (int i = 0; i < 4096; ++i) sorted[i] = i * 2;
+    std::vector<int> values(sorted.size());
+    for (size_t i = 0; i < sorted.size(); ++i) values[i] = sorted[i] * 3;
+
+    for (int key : { -5, 0, 1, 2048, 4097, 8190, 8191, 9000 }) {
+        BinaryTree<int> tree = BinaryTree<int>::fromSorted(sorted, values);
+        int* moved = tree.search(8190);
+        BinaryTree<int> greater = tree.split(key);
+
+        std::vector<int> less = keysOf(tree), rest = keysOf(greater);
+        assert(less.size() + rest.size() == sorted.size());
+        assert(less.empty() || less.back() < key);
+        assert(rest.empty() || rest.front() >= key);
+        assert(tree.isValidTreeString(tree.toString()) && greater.isValidTreeString(greater.toString()));
+        assert(tree.GetDepth() <= 16 && greater.GetDepth() <= 16);
+        if (key <= 8190) assert(greater.search(8190) == moved);
+
+        tree.join(greater);
+        assert(keysOf(tree) == sorted && keysOf(greater).empty());
+        assert(tree.GetDepth() <= 16);
+    }
+
+    BinaryTree<int> a, b;
+    for (int i = 0; i < 10; ++i) a.insert(i, i * 3);
+    for (int i = 5; i < 15; ++i) b.insert(i, i * 3);
+    bool threw = false;
+    try { a.join(b); }
+    catch (const std::invalid_argument&) { threw = true; }
+    assert(threw && keysOf(a).size() == 10 && keysOf(b).size() == 10);
+
+    BinaryTree<int> chain;
+    for (int i = 0; i < 2000; ++i) chain.insert(i, i * 3);
+    chain.enableValueIndex();
+    BinaryTree<int> tail = chain.split(1500);
+    assert(chain.containsNode(1499 * 3) && !chain.containsNode(1500 * 3));
+    assert(tail.containsNode(1500 * 3) && tail.valueIndexEnabled());
+    tail.insert(5000, 15000);
+    chain.join(tail);
+    std::vector<int> expected(2000);
+    for (int i = 0; i < 2000; ++i) expected[i] = i;
+    expected.push_back(5000);
+    assert(keysOf(chain) == expected);
+
+    AugmentedTree<int, RangeStats<int>> sums;
+    for (int i = 0; i < 1000; ++i) sums.insert((i * 389) % 1000, i);
+    int64_t total = sums.aggregate().sum;
+    AugmentedTree<int, RangeStats<int>> upper = sums.split(600);
+    assert(sums.aggregate().count == 600 && upper.aggregate().count == 400);
+    assert(sums.aggregate().sum + upper.aggregate().sum == total);
+    assert(upper.aggregate(600, 700).sum == sums.aggregate(600, 700).sum + upper.aggregate(600, 700).sum);
+
+    BinaryTree<int> bounded;
+    bounded.setHeightBound(12);
+    for (int i = 0; i < 1000; ++i) bounded.insert(i, i * 3);
+    BinaryTree<int> high = bounded.split(10);
+    assert(high.heightBound() == 12 && high.GetDepth() <= 12 && bounded.GetDepth() <= 12);
+
+    BinaryTree<int> hashed;
+    hashed.enableHashing();
+    hashed.enableKeyFilter();
+    for (int i = 0; i < 1000; ++i) hashed.insert((i * 389) % 1000, i);
+    BinaryTree<int> hashedHigh = hashed.split(400);
+    hashedHigh.insert(2000, 1);
+    hashedHigh.remove(500);
+    for (BinaryTree<int>* half : { &hashed, &hashedHigh }) {
+        assert(half->hashingEnabled() && half->keyFilterEnabled() && half->keyFilterMemory() > 0);
+        BinaryTree<int> rehashed = *half;
+        rehashed.enableHashing(false);
+        assert(rehashed.digest() == half->digest() && half->containsSubtree(rehashed));
+    }
+    for (int k = 0; k < 1000; ++k) {
+        assert((hashed.search(k) != nullptr) == (k < 400));
+        assert((hashedHigh.search(k) != nullptr) == (k >= 400 && k != 500));
+    }
+    assert(hashedHigh.search(2000) != nullptr);
+
+    std::cout << "Split and join tests completed successfully\n";
+}
+
+void TreeBulkRemoveTest() {
+    std::cout << "Bulk removal tests: ";
+
+    auto keysOf = [](const BinaryTree<int>& tree) {
+        std::vector<int> keys;
+        tree.traverseRange(INT_MIN, INT_MAX, [&](int key, const int&) { keys.push_back(key); });
+        return keys;
+    };
+
+    std::mt19937 rng(11);
+    for (int round = 0; round < 50; ++round) {
+        BinaryTree<int> tree;
+        std::vector<int> reference;
+        for (int i = 0; i < 500; ++i) {
+            int key = static_cast<int>(rng() % 1000);
+            tree.insert(key, key);
+            reference.push_back(key);
+        }
+        if (round % 2) tree.balance();
+        if (round % 5 == 0) tree.enableValueIndex();
+        std::sort(reference.begin(), reference.end());
+        reference.erase(std::unique(reference.begin(), reference.end()), reference.end());
+
+        int lo = static_cast<int>(rng() % 1100) - 50, hi = lo + static_cast<int>(rng() % 400) - 10;
+        auto first = std::lower_bound(reference.begin(), reference.end(), lo);
+        auto last = std::upper_bound(reference.begin(), reference.end(), hi);
+        int expected = lo <= hi ? static_cast<int>(last - first) : 0;
+        if (lo <= hi) reference.erase(first, last);
+
+        assert(tree.removeRange(lo, hi) == expected);
+        assert(keysOf(tree) == reference);
+        assert(tree.isValidTreeString(tree.toString()));
+        if (!reference.empty()) assert(tree.containsNode(reference.front()) && tree.getMax() == reference.back());
+        if (lo <= hi) assert(tree.search(lo) == nullptr && tree.search(hi) == nullptr);
+
+        int odd = tree.removeIf([](const int& v) { return v % 2 != 0; });
+        int before = static_cast<int>(reference.size());
+        reference.erase(std::remove_if(reference.begin(), reference.end(), [](int v) { return v % 2 != 0; }), reference.end());
+        assert(odd == before - static_cast<int>(reference.size()));
+        assert(keysOf(tree) == reference);
+        int minHeight = 0;
+        for (size_t m = reference.size(); m > 0; m >>= 1) ++minHeight;
+        if (odd) assert(tree.GetDepth() == minHeight);
+    }
+
+    BinaryTree<int> chain;
+    for (int i = 0; i < 20000; ++i) chain.insert(i, i);
+    assert(chain.removeRange(0, 17999) == 18000);
+    assert(chain.getMin() == 18000 && keysOf(chain).size() == 2000);
+    assert(chain.removeRange(30000, 40000) == 0 && chain.removeRange(19000, 18000) == 0);
+
+    BinaryTree<int> untouched;
+    for (int i = 0; i < 100; ++i) untouched.insert(i, i);
+    bool threw = false;
+    try {
+        untouched.removeIf([](const int& v) -> bool {
+            if (v == 50) throw std::runtime_error("stop");
+            return v < 50;
+            });
+    }
+    catch (const std::runtime_error&) { threw = true; }
+    assert(threw && keysOf(untouched).size() == 100);
+
+    AugmentedTree<int, RangeStats<int>> sums;
+    for (int i = 1; i <= 100; ++i) sums.insert(i, i);
+    sums.removeRange(11, 90);
+    assert(sums.aggregate().sum == 55 + (91 + 100) * 5 && sums.aggregate().count == 20);
+    sums.removeIf([](const int& v) { return v > 95; });
+    assert(sums.aggregate().max == 95 && sums.aggregate(1, 10).sum == 55);
+
+    std::cout << "Bulk removal tests completed successfully\n";
+}
+
+void TreeTombstoneTest() {
+    std::cout << "Tombstone tests: ";
+
+    auto keysOf = [](const BinaryTree<int>& tree) {
+        std::vector<int> keys;
+        tree.traverseRange(INT_MIN, INT_MAX, [&](int key, const int&) { keys.push_back(key); });
+        return keys;
+    };
+
+    std::mt19937 rng(23);
+    for (int round = 0; round < 20; ++round) {
+        BinaryTree<int> tree;
+        tree.setTombstoneRatio(round % 2 ? 0.5 : 0.2);
+        if (round % 4 == 0) tree.enableValueIndex();
+        std::map<int, int> reference;
+        for (int step = 0; step < 2000; ++step) {
+            int key = static_cast<int>(rng() % 300);
+            if (rng() % 3) {
+                assert(tree.remove(key) == (reference.erase(key) == 1));
+            }
+            else {
+                tree.insert(key, key * 2);
+                reference[key] = key * 2;
+            }
+            assert(tree.tombstoneCount() <= tree.tombstoneRatio() * 301);
+        }
+        std::vector<int> expected;
+        for (const auto& [key, value] : reference) expected.push_back(key);
+        assert(keysOf(tree) == expected);
+        for (int key = 0; key < 300; ++key) {
+            const int* found = tree.search(key);
+            assert(reference.count(key) ? found && *found == key * 2 : found == nullptr);
+        }
+        if (!reference.empty()) {
+            assert(tree.getMin() == reference.begin()->second && tree.getMax() == reference.rbegin()->second);
+            assert(tree.containsNode(reference.begin()->second));
+        }
+
+        BinaryTree<int> text = BinaryTree<int>::fromString(tree.toString());
+        std::stringstream bytes;
+        tree.toBinary(bytes);
+        BinaryTree<int> binary = BinaryTree<int>::fromBinary(bytes.str());
+        assert(text == tree && binary == tree && keysOf(binary) == expected);
+        assert(text.tombstoneCount() == tree.tombstoneCount() && binary.tombstoneCount() == tree.tombstoneCount());
+
+        BinaryTree<int> eager;
+        for (const auto& [key, value] : reference) eager.insert(key, value);
+        assert(tree.diff(eager).empty() && eager.diff(tree).empty());
+
+        tree.compact();
+        assert(tree.tombstoneCount() == 0 && keysOf(tree) == expected && tree.diff(eager).empty());
+    }
+
+    // Tombstones wait until they pass the ratio, then go in one rebuild.
+    BinaryTree<int> batch;
+    batch.setTombstoneRatio(0.25);
+    for (int i = 0; i < 1000; ++i) batch.insert(i, i);
+    batch.balance();
+    for (int i = 0; i < 250; ++i) batch.remove(i * 4);
+    assert(batch.tombstoneCount() == 250 && keysOf(batch).size() == 750);
+    batch.remove(1);
+    assert(batch.tombstoneCount() == 0 && keysOf(batch).size() == 749);
+    assert(!batch.remove(1) && batch.search(1) == nullptr);
+
+    // Reinserting a removed key revives its node; turning lazy mode off compacts.
+    BinaryTree<int> revive;
+    revive.setTombstoneRatio(0.9);
+    for (int i = 0; i < 10; ++i) revive.insert(i, i);
+    revive.remove(5);
+    assert(revive.search(5) == nullptr && revive.tombstoneCount() == 1);
+    revive.insert(5, 50);
+    assert(*revive.search(5) == 50 && revive.tombstoneCount() == 0);
+    revive.remove(3);
+    revive.remove(4);
+    revive.setTombstoneRatio(0);
+    assert(revive.tombstoneCount() == 0);
+    revive.setTombstoneRatio(0.9);
+    revive.remove(6);
+    revive.setTombstoneRatio(0.5);
+    assert(revive.tombstoneCount() == 1);
+    revive.setTombstoneRatio(0);
+    assert(revive.tombstoneCount() == 0);
+    assert((keysOf(revive) == std::vector<int>{ 0, 1, 2, 5, 7, 8, 9 }));
+
+    // A loaded tree keeps its tombstones; eager removes step over them.
+    BinaryTree<int> lazy;
+    lazy.setTombstoneRatio(0.9);
+    for (int i : { 50, 25, 75, 10, 30, 60, 90, 55, 65 }) lazy.insert(i, i);
+    lazy.remove(55);
+    lazy.remove(50);
+    BinaryTree<int> loaded = BinaryTree<int>::fromString(lazy.toString());
+    assert(loaded.tombstoneCount() == 2 && loaded.tombstoneRatio() == 0);
+    assert(!loaded.remove(50) && !loaded.remove(55));
+    assert(loaded.remove(25) && loaded.remove(75) && loaded.remove(60));
+    assert((keysOf(loaded) == std::vector<int>{ 10, 30, 65, 90 }));
+    assert(loaded.tombstoneCount() == 2 && loaded.isValidTreeString(loaded.toString()));
+    loaded.insert(55, 5);
+    assert(*loaded.search(55) == 5 && loaded.tombstoneCount() == 1);
+
+    // Paths lead through tombstones but do not stop on them.
+    BinaryTree<int> paths;
+    paths.setTombstoneRatio(0.9);
+    for (int i : { 2, 1, 3 }) paths.insert(i, i * 10);
+    paths.remove(1);
+    assert(paths.findByPath("L") == nullptr && *paths.findByPath("P") == 30);
+    assert(paths.findByRelativePath("L", 20) == nullptr && *paths.findByRelativePath("P", 20) == 30);
+    paths.remove(2);
+    assert(paths.findByPath("") == nullptr && *paths.findByPath("P") == 30);
+
+    // Aggregates, subtree extraction and bulk removal only see live keys.
+    AugmentedTree<int, RangeStats<int>> sums;
+    sums.setTombstoneRatio(0.9);
+    for (int i = 1; i <= 100; ++i) sums.insert(i, i);
+    for (int i = 1; i <= 100; i += 2) sums.remove(i);
+    assert(sums.aggregate().count == 50 && sums.aggregate().sum == 2550);
+    assert(sums.aggregate(1, 10).sum == 30 && sums.aggregate(1, 10).max == 10);
+    assert(sums.removeRange(1, 50) == 25 && sums.aggregate().count == 25);
+    assert(sums.removeIf([](const int& v) { return v > 90; }) == 5 && sums.tombstoneCount() == 0);
+    assert(sums.aggregate().sum == 1420);
+
+    bool threw = false;
+    try { revive.setTombstoneRatio(1); }
+    catch (const std::invalid_argument&) { threw = true; }
+    assert(threw);
+
+    std::cout << "Tombstone tests completed successfully\n";
+}
+
+void TreeHotCacheTest() {
+    std::cout << "Hot-key cache tests: ";
+
+    // Zipf-like keys: most lookups go to a few small keys.
+    std::mt19937 rng(31);
+    auto skewed = [&rng](int n) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return static_cast<int>(std::pow(n, u * u * u)) - 1;
+    };
+
+    for (int round = 0; round < 12; ++round) {
+        BinaryTree<int> tree;
+        tree.enableHotCache(round % 3 ? 64 : 5);
+        assert(tree.hotCacheSlots() == (round % 3 ? 64u : 8u));
+        if (round % 2) tree.setTombstoneRatio(0.3);
+        std::map<int, int> reference;
+        for (int i = 0; i < 400; ++i) {
+            tree.insert(i, i);
+            reference[i] = i;
+        }
+
+        for (int step = 0; step < 4000; ++step) {
+            int key = skewed(500);
+            int op = static_cast<int>(rng() % 20);
+            if (op == 0) {
+                tree.insert(key, step);
+                reference[key] = step;
+            }
+            else if (op == 1) {
+                assert(tree.remove(key) == (reference.erase(key) == 1));
+            }
+            else if (op == 2 && step % 400 == 2) {
+                tree.balance();
+            }
+            else if (op == 3 && step % 200 == 3) {
+                BinaryTree<int> upper = tree.split(key);
+                assert(upper.search(key - 1) == nullptr);
+                tree.join(upper);
+                assert(upper.search(key) == nullptr);
+            }
+            else {
+                const int* found = tree.search(key);
+                auto it = reference.find(key);
+                assert(it == reference.end() ? found == nullptr : found && *found == it->second);
+            }
+        }
+
+        BinaryTree<int> copy(tree);
+        assert(copy.hotCacheSlots() == tree.hotCacheSlots());
+        for (const auto& [key, value] : reference) assert(*copy.search(key) == value && *tree.search(key) == value);
+        tree.removeRange(0, 50);
+        tree.removeIf([](const int& v) { return v % 3 == 0; });
+        for (int key = 0; key <= 50; ++key) assert(tree.search(key) == nullptr);
+        for (const auto& [key, value] : reference) {
+            if (key > 50) assert(value % 3 == 0 ? tree.search(key) == nullptr : *tree.search(key) == value);
+        }
+    }
+
+    // Nodes copied by a running checkpoint must not stay cached: the copies get the updates
+    // and the originals are freed once it finishes.
+    BinaryTree<int> saved;
+    saved.enableHotCache();
+    for (int i = 0; i < 20000; ++i) saved.insert(i, i);
+    saved.balance();
+    for (int i = 0; i < 100; ++i) saved.search(i);
+    saved.checkpoint("hot_cache_test.bin");
+    for (int i = 0; i < 100; ++i) saved.insert(i, -i);
+    saved.waitCheckpoint();
+    for (int i = 0; i < 100; ++i) assert(*saved.search(i) == -i);
+    std::remove("hot_cache_test.bin");
+
+    // Eager removal of a node with two children moves its successor's key into it.
+    BinaryTree<int> moved;
+    moved.enableHotCache(16);
+    for (int i : { 50, 25, 75, 60, 90 }) moved.insert(i, i);
+    for (int i : { 50, 60, 75 }) assert(*moved.search(i) == i);
+    moved.remove(50);
+    assert(moved.search(50) == nullptr && *moved.search(60) == 60);
+    moved.remove(60);
+    assert(moved.search(60) == nullptr && *moved.search(75) == 75);
+
+    BinaryTree<int> upper = moved.split(80);
+    assert(upper.hotCacheSlots() == 16 && *upper.search(90) == 90 && *upper.search(90) == 90);
+    moved.join(upper);
+
+    moved.enableHotCache(0);
+    assert(moved.hotCacheSlots() == 0 && *moved.search(90) == 90);
+
+    std::cout << "Hot-key cache tests completed successfully\n";
+}
+
+void TreeKeyFilterTest() {
+    std::cout << "Key filter tests: ";
+
+    std::mt19937 rng(41);
+    BinaryTree<int> tree;
+    tree.enableKeyFilter();
+    assert(tree.keyFilterEnabled() && tree.search(1) == nullptr);
+    std::vector<int> keys;
+    for (int i = 0; i < 20000; ++i) {
+        int key = static_cast<int>(rng() % 1000000) * 2;
+        tree.insert(key, key);
+        keys.push_back(key);
+    }
+    for (int key : keys) assert(*tree.search(key) == key);
+
+    // Odd keys are never present.
+    tree.resetStats();
+    int misses = 0;
+    for (int i = 0; i < 20000; ++i) misses += tree.search(static_cast<int>(rng() % 1000000) * 2 + 1) == nullptr;
+    assert(misses == 20000);
+    TreeStats stats = tree.stats();
+    if (stats.enabled) {
+        assert(stats.filterRejects + stats.filterFalsePositives == 20000);
+        assert(stats.filterFalsePositiveRate() < 0.03);
+        assert(stats.toJson().find("\"filter_false_positive_rate\"") != std::string::npos);
+    }
+
+    // Removed keys linger in the filter but are never found; balance() drops them.
+    std::set<int> removed;
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        tree.remove(keys[i]);
+        removed.insert(keys[i]);
+    }
+    for (int key : keys) {
+        const int* found = tree.search(key);
+        assert(removed.count(key) ? found == nullptr : *found == key);
+    }
+    tree.balance();
+    tree.resetStats();
+    for (int key : removed) assert(tree.search(key) == nullptr);
+    if (tree.stats().enabled) assert(tree.stats().filterFalsePositiveRate() < 0.03);
+
+    // Split, join, lazy removal, copies and the hot-key cache keep lookups exact.
+    BinaryTree<int> lazy;
+    lazy.enableKeyFilter(8);
+    lazy.enableHotCache(32);
+    lazy.setTombstoneRatio(0.5);
+    std::map<int, int> reference;
+    for (int step = 0; step < 5000; ++step) {
+        int key = static_cast<int>(rng() % 2000);
+        if (rng() % 3) {
+            lazy.insert(key, step);
+            reference[key] = step;
+        }
+        else {
+            lazy.remove(key);
+            reference.erase(key);
+        }
+        if (step % 1000 == 999) {
+            BinaryTree<int> upper = lazy.split(key);
+            assert(upper.keyFilterEnabled());
+            for (int k = key; k < 2000; k += 7) assert((upper.search(k) != nullptr) == (reference.count(k) == 1));
+            lazy.join(upper);
+        }
+    }
+    BinaryTree<int> copy = lazy;
+    for (int key = 0; key < 2000; ++key) {
+        auto it = reference.find(key);
+        const int* found = lazy.search(key);
+        assert(it == reference.end() ? found == nullptr : found && *found == it->second);
+        assert(copy.search(key) == nullptr ? found == nullptr : *copy.search(key) == *found);
+    }
+    assert(lazy.memoryUsage().indexBytes >= lazy.keyFilterMemory() && lazy.keyFilterMemory() > 0);
+
+    lazy.enableKeyFilter(0);
+    assert(!lazy.keyFilterEnabled() && lazy.keyFilterMemory() == 0);
+    for (const auto& [key, value] : reference) assert(*lazy.search(key) == value);
+
+    std::cout << "Key filter tests completed successfully\n";
 }
\ No newline at end of file